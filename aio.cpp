@@ -0,0 +1,338 @@
+#include "aio.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+// Complete a request with blocking preads
+static void preadFully(ReadRequest& f_request)
+{
+	size_t done = 0;
+	while(done < f_request.size)
+	{
+		auto n = pread(f_request.fd, f_request.buffer + done, f_request.size - done, f_request.offset + done);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			f_request.result = -errno;
+			return;
+		}
+		if(!n)
+			break;
+		done += n;
+	}
+	f_request.result = done;
+}
+
+// ====================================
+// Every thread blocks in pread, so the number of reads in flight is the
+// number of threads. The threads are idle while waiting for the storage
+class PreadReader final : public IReader
+{
+public:
+	explicit PreadReader(unsigned f_depth):
+		m_depth(f_depth)
+	{}
+
+	const char* name() const final override { return "pread"; }
+
+	void read(std::vector<ReadRequest>& f_requests) final override
+	{
+		parallelFor(f_requests.size(), [&f_requests](size_t i)
+		{
+			preadFully(f_requests[i]);
+		}, m_depth);
+	}
+
+private:
+	unsigned	m_depth;
+};
+
+// ====================================
+#ifdef __linux__
+// io_uring accessed with raw system calls to avoid a liburing dependency
+class UringReader final : public IReader
+{
+public:
+	// Return nullptr if io_uring is not available
+	static std::unique_ptr<IReader> create(unsigned f_depth)
+	{
+		std::unique_ptr<UringReader> reader(new UringReader);
+		if(!reader->init(f_depth))
+			return nullptr;
+		return reader;
+	}
+
+	~UringReader()
+	{
+		if(m_sqes)
+			munmap(m_sqes, m_sqesSize);
+		if(m_cqRing && (m_cqRing != m_sqRing))
+			munmap(m_cqRing, m_cqRingSize);
+		if(m_sqRing)
+			munmap(m_sqRing, m_sqRingSize);
+		if(m_fd >= 0)
+			close(m_fd);
+	}
+
+	const char* name() const final override { return "io_uring"; }
+
+	void read(std::vector<ReadRequest>& f_requests) final override
+	{
+		if(m_fallback)
+		{
+			m_fallback->read(f_requests);
+			return;
+		}
+
+		std::vector<size_t> done(f_requests.size(), 0);
+		size_t next = 0;
+		unsigned inFlight = 0;
+
+		// Requests which are continued after a short read
+		std::vector<size_t> pending;
+		// Requests in the order of their submission queue entries
+		std::vector<size_t> pushed;
+
+		auto reap = [&]()
+		{
+			auto head = *m_cqHead;
+			auto tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+			for(; head != tail; ++head, --inFlight)
+			{
+				auto& cqe = m_cqes[head & *m_cqMask];
+				size_t i = cqe.user_data;
+				auto& request = f_requests[i];
+
+				if(cqe.res == -EINVAL)
+				{
+					// IORING_OP_READ is not supported by the kernel
+					preadFully(request);
+					done[i] = request.size;
+				}
+				else if(cqe.res == -EINTR || cqe.res == -EAGAIN)
+					pending.push_back(i);
+				else if(cqe.res < 0)
+				{
+					request.result = cqe.res;
+					done[i] = request.size;
+				}
+				else if(!cqe.res)
+				{
+					// End of the file
+					request.result = done[i];
+					done[i] = request.size;
+				}
+				else
+				{
+					done[i] += cqe.res;
+					if(done[i] < request.size)
+						pending.push_back(i);
+					else
+						request.result = done[i];
+				}
+			}
+			__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+		};
+
+		while((next < f_requests.size()) || inFlight || !pending.empty())
+		{
+			pushed.clear();
+			while(inFlight + pushed.size() < m_depth)
+			{
+				size_t i;
+				if(!pending.empty())
+				{
+					i = pending.back();
+					pending.pop_back();
+				}
+				else if(next < f_requests.size())
+					i = next++;
+				else
+					break;
+
+				auto& request = f_requests[i];
+				if(!request.size)
+				{
+					request.result = 0;
+					continue;
+				}
+				push(request, done[i], i);
+				pushed.push_back(i);
+			}
+			if(pushed.empty() && !inFlight)
+				continue;
+
+			auto nSubmitted = enter(pushed.size(), 1);
+			if((nSubmitted < 0) || (!nSubmitted && !inFlight))
+			{
+				// The ring is unusable: the entries which haven't been
+				// submitted are withdrawn and the ones in flight are waited
+				// for before the rest is read synchronously
+				unsubmit(pushed.size());
+				while(inFlight && (enter(0, 1) >= 0))
+					reap();
+				m_fallback = std::make_unique<PreadReader>(m_depth);
+
+				std::vector<ReadRequest> rest;
+				std::vector<size_t> indices;
+				for(size_t i = 0; i < f_requests.size(); ++i)
+				{
+					if((i >= next) || (done[i] < f_requests[i].size))
+					{
+						rest.push_back(f_requests[i]);
+						indices.push_back(i);
+					}
+				}
+				m_fallback->read(rest);
+				for(size_t i = 0; i < rest.size(); ++i)
+					f_requests[indices[i]].result = rest[i].result;
+				return;
+			}
+
+			// The entries which haven't been submitted are pushed again
+			if(static_cast<size_t>(nSubmitted) < pushed.size())
+			{
+				unsubmit(pushed.size() - nSubmitted);
+				pending.insert(pending.end(), pushed.begin() + nSubmitted, pushed.end());
+			}
+			inFlight += nSubmitted;
+
+			reap();
+		}
+	}
+
+private:
+	UringReader():
+		m_fd(-1),
+		m_sqRing(nullptr),
+		m_cqRing(nullptr),
+		m_sqes(nullptr)
+	{}
+
+	bool init(unsigned f_depth)
+	{
+		io_uring_params params = {};
+		m_fd = syscall(__NR_io_uring_setup, f_depth, &params);
+		if(m_fd < 0)
+			return false;
+		m_depth = params.sq_entries;
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool bSingleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if(bSingleMap)
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+		m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+		if(!m_sqRing)
+			return false;
+		m_cqRing = bSingleMap ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+		if(!m_cqRing)
+			return false;
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = static_cast<io_uring_sqe*>(map(m_sqesSize, IORING_OFF_SQES));
+		if(!m_sqes)
+			return false;
+
+		auto sq = static_cast<unsigned char*>(m_sqRing);
+		m_sqTail	= reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_sqMask	= reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_sqArray	= reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+		auto cq = static_cast<unsigned char*>(m_cqRing);
+		m_cqHead	= reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_cqTail	= reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_cqMask	= reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_cqes		= reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		return true;
+	}
+
+	void* map(size_t f_size, off_t f_offset)
+	{
+		auto p = mmap(nullptr, f_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, f_offset);
+		return (p == MAP_FAILED) ? nullptr : p;
+	}
+
+	void push(const ReadRequest& f_request, size_t f_done, size_t f_index)
+	{
+		auto tail = *m_sqTail;
+		auto index = tail & *m_sqMask;
+
+		auto& sqe = m_sqes[index];
+		sqe = {};
+		sqe.opcode		= IORING_OP_READ;
+		sqe.fd			= f_request.fd;
+		sqe.off			= f_request.offset + f_done;
+		sqe.addr		= reinterpret_cast<unsigned long long>(f_request.buffer + f_done);
+		sqe.len			= std::min<size_t>(f_request.size - f_done, 1 << 30); // Continued as a short read
+		sqe.user_data	= f_index;
+
+		m_sqArray[index] = index;
+		__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	// Withdraw the f_count last entries of the submission queue. The kernel
+	// reads the queue only in io_uring_enter
+	void unsubmit(unsigned f_count)
+	{
+		__atomic_store_n(m_sqTail, *m_sqTail - f_count, __ATOMIC_RELEASE);
+	}
+
+	// Return the number of the submitted entries or -1
+	int enter(unsigned f_submit, unsigned f_wait)
+	{
+		for(;;)
+		{
+			auto ret = syscall(__NR_io_uring_enter, m_fd, f_submit, f_wait, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if((ret >= 0) || (errno != EINTR))
+				return ret;
+		}
+	}
+
+private:
+	int				m_fd;
+	unsigned		m_depth;
+
+	void*			m_sqRing;
+	size_t			m_sqRingSize;
+	void*			m_cqRing;
+	size_t			m_cqRingSize;
+	io_uring_sqe*	m_sqes;
+	size_t			m_sqesSize;
+
+	unsigned*		m_sqTail;
+	unsigned*		m_sqMask;
+	unsigned*		m_sqArray;
+
+	unsigned*		m_cqHead;
+	unsigned*		m_cqTail;
+	unsigned*		m_cqMask;
+	io_uring_cqe*	m_cqes;
+
+	// Reads once the ring has failed
+	std::unique_ptr<IReader>	m_fallback;
+};
+#endif
+
+// ====================================
+std::unique_ptr<IReader> IReader::create(unsigned f_depth)
+{
+#ifdef __linux__
+	if(auto reader = UringReader::create(f_depth))
+		return reader;
+#endif
+	return std::make_unique<PreadReader>(f_depth);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
+
+// Positional read of a file region into a caller-owned buffer
+struct ReadRequest
+{
+	int				fd;
+	size_t			offset;
+	size_t			size;
+	unsigned char*	buffer;
+
+	ssize_t			result;		// Bytes read or -errno
+};
+
+
+// Executes batches of reads keeping many of them in flight, so that the
+// latency of the storage is paid once per batch rather than once per read
+class IReader
+{
+public:
+	// io_uring when the kernel supports it, a pool of pread threads otherwise
+	static std::unique_ptr<IReader>	create	(unsigned f_depth);
+
+	virtual const char*	name	() const = 0;
+
+	// Short reads are continued, so a result is less than the size only at
+	// the end of a file
+	virtual void		read	(std::vector<ReadRequest>& f_requests) = 0;
+
+	virtual ~IReader() {}
+};
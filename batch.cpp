@@ -0,0 +1,325 @@
+#include "batch.h"
+
+#include "aio.h"
+#include "buffer.h"
+#include "id3v2.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+static const size_t		s_windowFiles	= 32;
+static const unsigned	s_readDepth		= 64;
+// Enough for the ID3v2 header and the usual trailing tags
+static const size_t		s_headProbe		= 16 * 1024;
+static const size_t		s_tailProbe		= 16 * 1024;
+// Parts read into memory. Larger parts and the parts which don't fit the
+// bytes of a window are mapped. Two windows are held at once
+static const size_t		s_readPartMax	= 32 * 1024 * 1024;
+static const size_t		s_windowBytes	= 256 * 1024 * 1024;
+
+
+struct Slot
+{
+	LoadedFile					file;
+	int							fd	= -1;
+	RawBuffer					head;
+	RawBuffer					tail;
+
+	bool	ok	() const { return file.error.empty(); }
+};
+
+
+// Reads of a window which are issued at once
+class Round
+{
+public:
+	void add(size_t f_slot, int f_fd, size_t f_offset, unsigned char* f_buffer, size_t f_size)
+	{
+		m_requests.push_back({f_fd, f_offset, f_size, f_buffer, 0});
+		m_slots.push_back(f_slot);
+	}
+
+	void run(IReader& f_reader, std::vector<Slot>& f_ioSlots)
+	{
+		f_reader.read(m_requests);
+		for(size_t i = 0; i < m_requests.size(); ++i)
+		{
+			auto& request = m_requests[i];
+			auto& file = f_ioSlots[m_slots[i]].file;
+			if(!file.error.empty())
+				continue;
+			if(request.result < 0)
+				file.error = std::string("failed to read \"") + file.path + "\" (" + strerror(-request.result) + ')';
+			else if(static_cast<size_t>(request.result) < request.size)
+				file.error = "the \"" + file.path + "\" has been truncated while reading";
+		}
+		m_requests.clear();
+		m_slots.clear();
+	}
+
+private:
+	std::vector<ReadRequest>	m_requests;
+	std::vector<size_t>			m_slots;
+};
+
+
+// A pooled buffer of the f_size bytes which are left uninitialized
+static RawBuffer acquire(size_t f_size)
+{
+	auto buffer = BufferPool::instance().acquireRaw(f_size);
+	buffer.resize(f_size);
+	return buffer;
+}
+
+
+// Add a pooled buffer of the f_size to the f_ioFile
+static RawBuffer& addBuffer(LoadedFile& f_ioFile, size_t f_size)
+{
+	f_ioFile.buffers.push_back(acquire(f_size));
+	return f_ioFile.buffers.back();
+}
+
+
+// Map the f_ioFile unless it's mapped already. Return false on an error
+static bool mapFile(LoadedFile& f_ioFile)
+{
+	if(f_ioFile.mapping)
+		return true;
+
+	try
+	{
+		f_ioFile.mapping = std::make_unique<MappedFile>(f_ioFile.path);
+	}
+	catch(const std::exception& e)
+	{
+		f_ioFile.error = e.what();
+		return false;
+	}
+	if(f_ioFile.mapping->size() != f_ioFile.layout.fileSize)
+	{
+		f_ioFile.error = "the \"" + f_ioFile.path + "\" has been modified while reading";
+		return false;
+	}
+	return true;
+}
+
+
+static void loadWindow(IReader& f_reader, std::vector<Slot>& f_ioSlots, unsigned f_parts)
+{
+	for(auto& slot : f_ioSlots)
+	{
+		auto& file = slot.file;
+		slot.fd = open(file.path.c_str(), O_RDONLY);
+		struct stat st;
+		if((slot.fd < 0) || fstat(slot.fd, &st))
+			file.error = std::string("failed to open \"") + file.path + "\" (" + strerror(errno) + ')';
+		else
+			file.layout.fileSize = st.st_size;
+	}
+
+	// Head and tail probes. A small file is read at once
+	Round round;
+	for(size_t i = 0; i < f_ioSlots.size(); ++i)
+	{
+		auto& slot = f_ioSlots[i];
+		if(!slot.ok())
+			continue;
+		auto size = slot.file.layout.fileSize;
+		if(size <= s_headProbe + s_tailProbe)
+		{
+			slot.head = acquire(size);
+			round.add(i, slot.fd, 0, slot.head.data(), size);
+			continue;
+		}
+		slot.head = acquire(s_headProbe);
+		slot.tail = acquire(s_tailProbe);
+		round.add(i, slot.fd, 0, slot.head.data(), slot.head.size());
+		round.add(i, slot.fd, size - slot.tail.size(), slot.tail.data(), slot.tail.size());
+	}
+	round.run(f_reader, f_ioSlots);
+
+	for(auto& slot : f_ioSlots)
+	{
+		if(!slot.ok())
+			continue;
+		if(slot.head.size() == slot.file.layout.fileSize)
+		{
+			slot.tail = acquire(slot.head.size());
+			memcpy(slot.tail.data(), slot.head.data(), slot.head.size());
+		}
+		slot.file.layout.probeHead(slot.head.data(), slot.head.size());
+	}
+
+	// Trailing tags. A tag larger than the tail probe requires another read
+	// of the bytes in front of the probe only
+	for(bool bResolved = false; !bResolved;)
+	{
+		bResolved = true;
+		for(size_t i = 0; i < f_ioSlots.size(); ++i)
+		{
+			auto& slot = f_ioSlots[i];
+			size_t needed;
+			if(!slot.ok() || slot.file.layout.probeTrailer(slot.tail.data(), slot.tail.size(), needed))
+				continue;
+
+			bResolved = false;
+			auto nMore = needed - slot.tail.size();
+			auto tail = acquire(needed);
+			memcpy(tail.data() + nMore, slot.tail.data(), slot.tail.size());
+			BufferPool::instance().release(std::move(slot.tail));
+			slot.tail = std::move(tail);
+			round.add(i, slot.fd, slot.file.layout.fileSize - needed, slot.tail.data(), nMore);
+		}
+		round.run(f_reader, f_ioSlots);
+	}
+
+	// Requested parts
+	size_t nWindowBytes = 0;
+	auto isRead = [&nWindowBytes](size_t f_size)
+	{
+		if((f_size > s_readPartMax) || (nWindowBytes + f_size > s_windowBytes))
+			return false;
+		nWindowBytes += f_size;
+		return true;
+	};
+	for(size_t i = 0; i < f_ioSlots.size(); ++i)
+	{
+		auto& slot = f_ioSlots[i];
+		auto& file = slot.file;
+		auto& layout = file.layout;
+		if(!slot.ok())
+			continue;
+
+		if((f_parts & LoadedFile::Parts::ID3v2) && layout.id3v2Size)
+		{
+			if(isRead(layout.id3v2Size))
+			{
+				auto nProbed = std::min(slot.head.size(), layout.id3v2Size);
+				auto& buffer = addBuffer(file, layout.id3v2Size);
+				memcpy(buffer.data(), slot.head.data(), nProbed);
+				if(nProbed < layout.id3v2Size)
+					round.add(i, slot.fd, layout.id3v2Offset + nProbed, buffer.data() + nProbed, layout.id3v2Size - nProbed);
+				file.id3v2 = {buffer.data(), buffer.size()};
+			}
+			else if(mapFile(file))
+				file.id3v2 = {file.mapping->data() + layout.id3v2Offset, layout.id3v2Size};
+		}
+
+		if((f_parts & LoadedFile::Parts::Trailer) && layout.trailerSize())
+		{
+			auto& buffer = addBuffer(file, layout.trailerSize());
+			memcpy(buffer.data(), slot.tail.data() + slot.tail.size() - buffer.size(), buffer.size());
+			file.trailer = {buffer.data(), buffer.size()};
+		}
+
+		if((f_parts & LoadedFile::Parts::MPEG) && layout.mpegSize && file.error.empty())
+		{
+			if(isRead(layout.mpegSize))
+			{
+				// A small file is already read whole with the head
+				auto nProbed = (slot.head.size() > layout.mpegOffset) ?
+							   std::min(slot.head.size() - layout.mpegOffset, layout.mpegSize) : 0;
+				auto& buffer = addBuffer(file, layout.mpegSize);
+				memcpy(buffer.data(), slot.head.data() + layout.mpegOffset, nProbed);
+				if(nProbed < layout.mpegSize)
+					round.add(i, slot.fd, layout.mpegOffset + nProbed, buffer.data() + nProbed, layout.mpegSize - nProbed);
+				file.mpeg = {buffer.data(), buffer.size()};
+			}
+			else if(mapFile(file))
+				file.mpeg = {file.mapping->data() + layout.mpegOffset, layout.mpegSize};
+		}
+	}
+	round.run(f_reader, f_ioSlots);
+
+	for(auto& slot : f_ioSlots)
+	{
+		if(slot.fd >= 0)
+			close(slot.fd);
+		slot.fd = -1;
+		BufferPool::instance().release(std::move(slot.head));
+		BufferPool::instance().release(std::move(slot.tail));
+	}
+}
+
+
+void processFiles(const std::vector<std::string>& f_paths, unsigned f_parts,
+				  const std::function<void(size_t f_index, LoadedFile& f_file)>& f_process)
+{
+	auto reader = IReader::create(s_readDepth);
+
+	auto nWindows = (f_paths.size() + s_windowFiles - 1) / s_windowFiles;
+	auto load = [&](size_t f_window, std::vector<Slot>& f_outSlots)
+	{
+		auto first = f_window * s_windowFiles;
+		f_outSlots.clear();
+		f_outSlots.resize(std::min(s_windowFiles, f_paths.size() - first));
+		for(size_t i = 0; i < f_outSlots.size(); ++i)
+			f_outSlots[i].file.path = f_paths[first + i];
+		loadWindow(*reader, f_outSlots, f_parts);
+	};
+
+	std::vector<Slot> current, next;
+	if(nWindows)
+		load(0, current);
+
+	for(size_t w = 0; w < nWindows; ++w)
+	{
+		// Exceptions are rethrown on this thread once the loader has joined
+		std::exception_ptr loadError;
+		std::exception_ptr processError;
+
+		std::thread loader;
+		if(w + 1 < nWindows)
+		{
+			loader = std::thread([&load, &next, &loadError, w]()
+			{
+				try
+				{
+					load(w + 1, next);
+				}
+				catch(...)
+				{
+					loadError = std::current_exception();
+				}
+			});
+		}
+
+		try
+		{
+			parallelFor(current.size(), [&](size_t i)
+			{
+				f_process(w * s_windowFiles + i, current[i].file);
+			});
+		}
+		catch(...)
+		{
+			processError = std::current_exception();
+		}
+
+		if(loader.joinable())
+			loader.join();
+		if(processError)
+			std::rethrow_exception(processError);
+		if(loadError)
+			std::rethrow_exception(loadError);
+		std::swap(current, next);
+	}
+}
+
+
+void LoadedFile::release()
+{
+	auto& pool = BufferPool::instance();
+	for(auto& buffer : buffers)
+		pool.release(std::move(buffer));
+	*this = LoadedFile();
+}
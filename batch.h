@@ -0,0 +1,55 @@
+#pragma once
+
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "file.h"
+#include "layout.h"
+
+
+// A file loaded for batch processing. Only the requested parts are loaded:
+// they are read into pooled buffers or, if a part is too large, mapped
+struct LoadedFile
+{
+	enum Parts
+	{
+		None	= 0,
+		ID3v2	= 1 << 0,	// The whole ID3v2 tag
+		Trailer	= 1 << 1,	// The trailing tags
+		MPEG	= 1 << 2	// The MPEG data region
+	};
+
+	std::string					path;
+	std::string					error;		// Empty if the file has been loaded
+
+	Layout						layout;
+	ByteView					id3v2	= {nullptr, 0};	// From the layout.id3v2Offset
+	ByteView					trailer	= {nullptr, 0};	// From the layout.trailerOffset()
+	ByteView					mpeg	= {nullptr, 0};	// From the layout.mpegOffset
+
+	// The bytes of the parts
+	std::vector<RawBuffer>		buffers;
+	std::unique_ptr<MappedFile>	mapping;
+
+	// Return the buffers to the BufferPool and unmap the file once the file
+	// has been processed
+	void release();
+};
+
+
+// Load the files and call the f_process for each of them on a pool of worker
+// threads. Files are loaded in windows with all reads of a window in flight:
+// head and tail probes first to resolve the tags, then the requested parts.
+// A small file is read whole with a single read its parts are copied from.
+// A trailing tag larger than the tail probe is resolved with another read of
+// the missing bytes only, so the trailing tags usually take one round trip. Loading of the next window
+// overlaps processing of the current one. The bytes read for a window are
+// bounded: a large part or a part beyond the bound is mapped and its pages
+// are read on demand. An exception thrown by the f_process or the loading
+// stops the processing and is rethrown
+void processFiles(const std::vector<std::string>& f_paths, unsigned f_parts,
+				  const std::function<void(size_t f_index, LoadedFile& f_file)>& f_process);
@@ -0,0 +1,90 @@
+#include "buffer.h"
+
+
+// Enough for the files of a window being loaded and the ones being processed.
+// A buffer which doesn't fit is freed
+static const size_t s_maxBytes = 256 * 1024 * 1024;
+
+
+BufferPool& BufferPool::instance()
+{
+	static BufferPool s_pool;
+	return s_pool;
+}
+
+
+Buffer BufferPool::acquire(size_t f_capacity)
+{
+	return acquire(m_buffers, f_capacity);
+}
+
+
+RawBuffer BufferPool::acquireRaw(size_t f_capacity)
+{
+	return acquire(m_rawBuffers, f_capacity);
+}
+
+
+void BufferPool::release(Buffer&& f_buffer)
+{
+	release(m_buffers, std::move(f_buffer));
+}
+
+
+void BufferPool::release(RawBuffer&& f_buffer)
+{
+	release(m_rawBuffers, std::move(f_buffer));
+}
+
+
+template<typename B>
+B BufferPool::acquire(std::vector<B>& f_buffers, size_t f_capacity)
+{
+	B buffer;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// The smallest buffer which fits, otherwise the largest one to grow
+		auto best = f_buffers.end();
+		for(auto it = f_buffers.begin(); it != f_buffers.end(); ++it)
+		{
+			if(best == f_buffers.end())
+				best = it;
+			else if(best->capacity() < f_capacity)
+			{
+				if(it->capacity() > best->capacity())
+					best = it;
+			}
+			else if((it->capacity() >= f_capacity) && (it->capacity() < best->capacity()))
+				best = it;
+		}
+		if(best != f_buffers.end())
+		{
+			std::swap(*best, f_buffers.back());
+			buffer = std::move(f_buffers.back());
+			f_buffers.pop_back();
+			m_bytes -= buffer.capacity();
+		}
+	}
+
+	buffer.clear();
+	buffer.reserve(f_capacity);
+	return buffer;
+}
+
+
+template<typename B>
+void BufferPool::release(std::vector<B>& f_buffers, B&& f_buffer)
+{
+	// A buffer which isn't pooled is freed after the lock
+	B buffer(std::move(f_buffer));
+	if(!buffer.capacity())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_bytes + buffer.capacity() <= s_maxBytes)
+	{
+		m_bytes += buffer.capacity();
+		f_buffers.push_back(std::move(buffer));
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Allocator which default-initializes the elements, so a resize doesn't zero
+// the bytes which are about to be overwritten, e.g. by a read
+template<typename T>
+struct DefaultInitAllocator : std::allocator<T>
+{
+	template<typename U>
+	struct rebind { using other = DefaultInitAllocator<U>; };
+
+	using std::allocator<T>::allocator;
+
+	template<typename U>
+	void construct(U* f_p) { ::new(static_cast<void*>(f_p)) U; }
+	template<typename U, typename... Args>
+	void construct(U* f_p, Args&&... f_args) { ::new(static_cast<void*>(f_p)) U(std::forward<Args>(f_args)...); }
+};
+
+
+// Buffers which the library serializes into
+using Buffer = std::vector<unsigned char>;
+// Buffers which are read into
+using RawBuffer = std::vector<unsigned char, DefaultInitAllocator<unsigned char>>;
+
+
+// Process-wide pool of byte buffers. A released buffer keeps its capacity, so
+// the buffers of files processed one after another are allocated only once.
+// The capacity kept in the pool is bounded, larger buffers are freed
+class BufferPool final
+{
+public:
+	static BufferPool& instance();
+
+	// Return an empty buffer with at least the f_capacity reserved
+	Buffer		acquire		(size_t f_capacity);
+	RawBuffer	acquireRaw	(size_t f_capacity);
+	void		release		(Buffer&& f_buffer);
+	void		release		(RawBuffer&& f_buffer);
+
+private:
+	BufferPool() = default;
+
+	template<typename B>
+	B		acquire	(std::vector<B>& f_buffers, size_t f_capacity);
+	template<typename B>
+	void	release	(std::vector<B>& f_buffers, B&& f_buffer);
+
+private:
+	std::mutex				m_mutex;
+	std::vector<Buffer>		m_buffers;
+	std::vector<RawBuffer>	m_rawBuffers;
+	size_t					m_bytes = 0;	// Capacity of the pooled buffers
+};
+
+
+// A buffer which is returned to the pool when it goes out of scope
+class PooledBuffer final
+{
+public:
+	explicit PooledBuffer(size_t f_capacity):
+		m_buffer(BufferPool::instance().acquire(f_capacity))
+	{}
+	~PooledBuffer() { BufferPool::instance().release(std::move(m_buffer)); }
+
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+	Buffer&	get() { return m_buffer; }
+
+private:
+	Buffer	m_buffer;
+};
@@ -3,125 +3,196 @@
 #include "External/inc/tag.h"
 
 #include "commands.h"
+#include "file.h"
+#include "layout.h"
+#include "id3v2.h"
+#include "frames.h"
+#include "edit.h"
+#include "batch.h"
+#include "buffer.h"
+#include "hash.h"
+#include "seekindex.h"
+#include "json.h"
+#include "report.h"
 
 #include "common.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
 
-static bool g_verbose = true;
-#define VERBOSE(msg) if(g_verbose) LOG(msg)
+#include <sys/stat.h>
+
+
+// Progress messages of a command. They are off with a plan, so the plan is
+// the only output besides warnings
+#define VERBOSE(msg) if(!m_plan) LOG(msg)
+
+
+// ====================================
+void Command::planOnly()
+{
+	m_plan = true;
+}
 
 
 // ====================================
-// find test -name "*.mp3" -print0 | xargs -0 -I{} ./mp3_cut -i mpeg {}
+// find test -name "*.mp3" -print0 | xargs -0 ./mp3_cut -i mpeg
 static const uint s_captionWidth = 16;
 
 using tag_frame_count_getter_t  = unsigned              (Tag::IID3v2::*)() const;
 using tag_frame_getter_t        = const std::string&    (Tag::IID3v2::*)(unsigned f_index) const;
 using tag_genre_index_getter_t  = int                   (Tag::IID3v2::*)(unsigned f_index) const;
 
-static void printSeparator(bool& f_ioFirstFlag);
+static void printSeparator(std::ostream& f_os, bool& f_ioFirstFlag);
 static std::string makeAlignedCaption(uint f_width, const std::string& f_name, int f_index = -1);
-static void printFrames(const std::string& f_name, const Tag::IID3v2& f_tag, tag_frame_count_getter_t f_pfnCount, tag_frame_getter_t f_pfnGetter, tag_genre_index_getter_t f_pfnGenreIndex);
+static void printFrames(std::ostream& f_os, const std::string& f_name, const Tag::IID3v2& f_tag, tag_frame_count_getter_t f_pfnCount, tag_frame_getter_t f_pfnGetter, tag_genre_index_getter_t f_pfnGenreIndex);
 
+// Info is printed into a per-file buffer on a worker thread
+#define OUT(msg)			f_os << msg << '\n'
+#define OUT_WARNING(msg)	OUT("WARNING: " << msg)
 
-bool CmdInfo::exec() const
+
+static unsigned getInfoParts(uint f_mask)
 {
-	std::shared_ptr<IMP3> mp3;
+	if(f_mask == CmdInfo::FieldsMask::All)
+		return LoadedFile::Parts::MPEG | LoadedFile::Parts::ID3v2 | LoadedFile::Parts::Trailer;
+
+	unsigned parts = LoadedFile::Parts::None;
+	if(f_mask & CmdInfo::FieldsMask::MPEG)
+		parts |= LoadedFile::Parts::MPEG;
+	if(f_mask & CmdInfo::FieldsMask::ID3v2)
+		parts |= LoadedFile::Parts::ID3v2;
+	if(f_mask & (CmdInfo::FieldsMask::ID3v1 | CmdInfo::FieldsMask::APE | CmdInfo::FieldsMask::Lyrics))
+		parts |= LoadedFile::Parts::Trailer;
+	return parts;
+}
+
+
+static bool printInfo(std::ostream& f_os, const LoadedFile& f_file, CmdInfo::FieldsMask f_fields)
+{
+	if(!f_file.error.empty())
+	{
+		OUT("ERROR: " << f_file.error);
+		return false;
+	}
+
+	//ASSERT(m_fields != FieldsMask::None);
+	uint mask = static_cast<uint>(f_fields);
+	bool bAllFields = (f_fields == CmdInfo::FieldsMask::All);
+	auto parts = getInfoParts(mask);
+
+	// Only the requested parts are loaded and parsed
+	auto& layout = f_file.layout;
+	std::shared_ptr<MPEG::IStream>	mpeg;
+	std::shared_ptr<Tag::IID3v1>	id3v1;
+	std::shared_ptr<Tag::IID3v2>	id3v2;
+	std::shared_ptr<Tag::IAPE>		ape;
+	std::shared_ptr<Tag::ILyrics>	lyrics;
 	try
 	{
-		VERBOSE("Outputting info for \"" << m_pathIn << '"');
-		mp3 = IMP3::create(m_pathIn);
+		auto trailer = f_file.trailer.data;
+		auto trailerOffset = layout.trailerOffset();
+		auto trailerSize = f_file.trailer.size;
+
+		if((parts & LoadedFile::Parts::MPEG) && layout.mpegSize)
+			mpeg = MPEG::IStream::create(f_file.mpeg.data, f_file.mpeg.size);
+		if((parts & LoadedFile::Parts::ID3v2) && layout.id3v2Size)
+			id3v2 = Tag::IID3v2::create(f_file.id3v2.data, 0, f_file.id3v2.size);
+		if((parts & LoadedFile::Parts::Trailer) && layout.id3v1Size)
+			id3v1 = Tag::IID3v1::create(trailer, layout.id3v1Offset - trailerOffset, trailerSize);
+		if((parts & LoadedFile::Parts::Trailer) && layout.apeSize)
+			ape = Tag::IAPE::create(trailer, layout.apeOffset - trailerOffset, trailerSize);
+		if((parts & LoadedFile::Parts::Trailer) && layout.lyricsSize)
+			lyrics = Tag::ILyrics::create(trailer, layout.lyricsOffset - trailerOffset, trailerSize);
 	}
-	catch(IMP3::exception& e)
+	catch(const std::exception& e)
 	{
-		ERROR(e.what());
+		OUT("ERROR: " << e.what());
 		return false;
 	}
-	//catch(...)
-	//{
-	//	return false;
-	//}
-	if(mp3->hasIssues())
-		WARNING("the \"" << m_pathIn << "\" has issues");
+	if(layout.hasIssues() || (mpeg && mpeg->hasIssues()) || (id3v2 && id3v2->hasIssues()))
+		OUT_WARNING("the \"" << f_file.path << "\" has issues");
 
-	//ASSERT(m_fields != FieldsMask::None);
-	uint mask = static_cast<uint>(m_fields);
-	bool bAllFields = (m_fields == FieldsMask::All);
 	bool bSeparatorPrintFlag = true;
 	// MPEG
-	if((mask & FieldsMask::MPEG) || bAllFields)
+	if((mask & CmdInfo::FieldsMask::MPEG) || bAllFields)
 	{
-		if(auto mpeg = mp3->mpegStream())
+		if(mpeg)
 		{
-			printSeparator(bSeparatorPrintFlag);
+			printSeparator(f_os, bSeparatorPrintFlag);
 
-			auto offset = mp3->mpegStreamOffset();
+			auto offset = layout.mpegOffset;
 			auto size = mpeg->getSize();
-			LOG("MPEG stream @ offset " <<
+			OUT("MPEG stream @ offset " <<
 				offset << " (0x" << OUT_HEX(offset) << ") +" << size << " (0x" << OUT_HEX(size) << ')');
 			
 			auto firstFrameOffset = offset + mpeg->getFrameOffset(0);
-			LOG("First frame @ offset " << firstFrameOffset << " (0x" << OUT_HEX(firstFrameOffset) << ')');
-
-			LOG(mpeg->getFrameCount() << " frames (" << mpeg->getLength() << " sec)");
-			LOG("MPEG " << MPEG::IStream::str(mpeg->getVersion()) << " Layer " << mpeg->getLayer());
-			LOG("Bitrate      : " << mpeg->getBitrate() << " kbps" << (mpeg->isVBR() ? " (VBR)" : ""));
-			LOG("Sampling Rate: " << mpeg->getSamplingRate() << " Hz");
-			LOG("Channel Mode : " << MPEG::IStream::str(mpeg->getChannelMode()));
-			LOG("Emphasis     : " << MPEG::IStream::str(mpeg->getEmphasis()));
+			OUT("First frame @ offset " << firstFrameOffset << " (0x" << OUT_HEX(firstFrameOffset) << ')');
+
+			OUT(mpeg->getFrameCount() << " frames (" << mpeg->getLength() << " sec)");
+			OUT("MPEG " << MPEG::IStream::str(mpeg->getVersion()) << " Layer " << mpeg->getLayer());
+			OUT("Bitrate      : " << mpeg->getBitrate() << " kbps" << (mpeg->isVBR() ? " (VBR)" : ""));
+			OUT("Sampling Rate: " << mpeg->getSamplingRate() << " Hz");
+			OUT("Channel Mode : " << MPEG::IStream::str(mpeg->getChannelMode()));
+			OUT("Emphasis     : " << MPEG::IStream::str(mpeg->getEmphasis()));
 		}
 		else
 		{
-			printSeparator(bSeparatorPrintFlag);
-			WARNING("no MPEG stream");
+			printSeparator(f_os, bSeparatorPrintFlag);
+			OUT_WARNING("no MPEG stream");
 		}
 
-		mask = mask & ~FieldsMask::MPEG;
+		mask = mask & ~CmdInfo::FieldsMask::MPEG;
 	}
 	// ID3v1
-	if((mask & FieldsMask::ID3v1) || bAllFields)
+	if((mask & CmdInfo::FieldsMask::ID3v1) || bAllFields)
 	{
-		if(auto tag = mp3->tagID3v1())
+		if(auto tag = id3v1)
 		{
-			printSeparator(bSeparatorPrintFlag);
+			printSeparator(f_os, bSeparatorPrintFlag);
 
-			auto offset = mp3->tagID3v1Offset();
+			auto offset = layout.id3v1Offset;
 			auto size = tag->getSize();
-			LOG("ID3v" << (tag->isV11() ? "1.1" : "1") << " tag @ offset " <<
+			OUT("ID3v" << (tag->isV11() ? "1.1" : "1") << " tag @ offset " <<
 				offset << " (0x" << OUT_HEX(offset) << ") +" << size << " (0x" << OUT_HEX(size) << ')');
 
-			LOG("Title  : " << tag->getTitle	());
-			LOG("Artist : " << tag->getArtist	());
-			LOG("Album  : " << tag->getAlbum	());
-			LOG("Year   : " << tag->getYear		());
-			LOG("Comment: " << tag->getComment	());
+			OUT("Title  : " << tag->getTitle	());
+			OUT("Artist : " << tag->getArtist	());
+			OUT("Album  : " << tag->getAlbum	());
+			OUT("Year   : " << tag->getYear		());
+			OUT("Comment: " << tag->getComment	());
 			if(tag->isV11())
-				LOG("Track:   " << tag->getTrack());
+				OUT("Track:   " << tag->getTrack());
 
 			auto idGenre = tag->getGenreIndex();
-			LOG("Genre:   " << idGenre << " (" <<  Tag::genre(idGenre) << ')');
+			OUT("Genre:   " << idGenre << " (" <<  Tag::genre(idGenre) << ')');
 		}
-		else if(mask & FieldsMask::ID3v1)
+		else if(mask & CmdInfo::FieldsMask::ID3v1)
 		{
-			printSeparator(bSeparatorPrintFlag);
-			LOG("No ID3v1 tag");
+			printSeparator(f_os, bSeparatorPrintFlag);
+			OUT("No ID3v1 tag");
 		}
 
-		mask = mask & ~FieldsMask::ID3v1;
+		mask = mask & ~CmdInfo::FieldsMask::ID3v1;
 	}
 	// ID3v2
-	if((mask & FieldsMask::ID3v2) || bAllFields)
+	if((mask & CmdInfo::FieldsMask::ID3v2) || bAllFields)
 	{
-		if(auto tag = mp3->tagID3v2())
+		if(auto tag = id3v2)
 		{
-			printSeparator(bSeparatorPrintFlag);
+			printSeparator(f_os, bSeparatorPrintFlag);
 
-			auto offset = mp3->tagID3v2Offset();
+			auto offset = layout.id3v2Offset;
 			auto size = tag->getSize();
-			LOG("ID3v2." << tag->getMinorVersion() << '.' << tag->getRevision() << " tag @ offset " <<
+			OUT("ID3v2." << tag->getMinorVersion() << '.' << tag->getRevision() << " tag @ offset " <<
 				offset << " (0x" << OUT_HEX(offset) << ") +" << size << " (0x" << OUT_HEX(size) << ')');
 
-			#define PRINT_FRAMES(Title, Name, ExFn)	printFrames(Title, *tag, &Tag::IID3v2::get##Name##Count, &Tag::IID3v2::get##Name, ExFn)
+			#define PRINT_FRAMES(Title, Name, ExFn)	printFrames(f_os, Title, *tag, &Tag::IID3v2::get##Name##Count, &Tag::IID3v2::get##Name, ExFn)
 			#define PRINT_EX(Title, Name)           PRINT_FRAMES(Title, Name, nullptr)
 			#define PRINT(Name)						PRINT_EX(#Name, Name)
 			PRINT		(Track);
@@ -148,61 +219,61 @@ bool CmdInfo::exec() const
 			auto unknown_frames = tag->getUnknownFrames();
 			if(!unknown_frames.empty())
 			{
-				std::cout << makeAlignedCaption(s_captionWidth, "Unknown frames");
-				for_each(unknown_frames.begin(), unknown_frames.end(), [](auto& str)
+				f_os << makeAlignedCaption(s_captionWidth, "Unknown frames");
+				for_each(unknown_frames.begin(), unknown_frames.end(), [&f_os](auto& str)
 				{
-					std::cout << " " << str;
+					f_os << " " << str;
 				});
-				std::cout << std::endl;
+				f_os << '\n';
 			}
 		}
-		else if(mask & FieldsMask::ID3v2)
+		else if(mask & CmdInfo::FieldsMask::ID3v2)
 		{
-			printSeparator(bSeparatorPrintFlag);
-			LOG("No ID3v1 tag");
+			printSeparator(f_os, bSeparatorPrintFlag);
+			OUT("No ID3v2 tag");
 		}
 
-		mask = mask & ~FieldsMask::ID3v2;
+		mask = mask & ~CmdInfo::FieldsMask::ID3v2;
 	}
 	// APE
-	if((mask & FieldsMask::APE) || bAllFields)
+	if((mask & CmdInfo::FieldsMask::APE) || bAllFields)
 	{
-		if(auto tag = mp3->tagAPE())
+		if(auto tag = ape)
 		{
-			printSeparator(bSeparatorPrintFlag);
+			printSeparator(f_os, bSeparatorPrintFlag);
 
-			auto offset = mp3->tagAPEOffset();
+			auto offset = layout.apeOffset;
 			auto size = tag->getSize();
-			LOG("APE tag @ offset " <<
+			OUT("APE tag @ offset " <<
 				offset << " (0x" << OUT_HEX(offset) << ") +" << size << " (0x" << OUT_HEX(size) << ')');
 		}
-		else if(mask & FieldsMask::APE)
+		else if(mask & CmdInfo::FieldsMask::APE)
 		{
-			printSeparator(bSeparatorPrintFlag);
-			LOG("No APE tag");
+			printSeparator(f_os, bSeparatorPrintFlag);
+			OUT("No APE tag");
 		}
 
-		mask = mask & ~FieldsMask::APE;
+		mask = mask & ~CmdInfo::FieldsMask::APE;
 	}
 	// Lyrics
-	if((mask & FieldsMask::Lyrics) || bAllFields)
+	if((mask & CmdInfo::FieldsMask::Lyrics) || bAllFields)
 	{
-		if(auto tag = mp3->tagLyrics())
+		if(auto tag = lyrics)
 		{
-			printSeparator(bSeparatorPrintFlag);
+			printSeparator(f_os, bSeparatorPrintFlag);
 
-			auto offset = mp3->tagLyricsOffset();
+			auto offset = layout.lyricsOffset;
 			auto size = tag->getSize();
-			LOG("Lyrics tag @ offset " <<
+			OUT("Lyrics tag @ offset " <<
 				offset << " (0x" << OUT_HEX(offset) << ") +" << size << " (0x" << OUT_HEX(size) << ')');
 		}
-		else if(mask & FieldsMask::Lyrics)
+		else if(mask & CmdInfo::FieldsMask::Lyrics)
 		{
-			printSeparator(bSeparatorPrintFlag);
-			LOG("No Lyrics tag");
+			printSeparator(f_os, bSeparatorPrintFlag);
+			OUT("No Lyrics tag");
 		}
 
-		mask = mask & ~FieldsMask::Lyrics;
+		mask = mask & ~CmdInfo::FieldsMask::Lyrics;
 	}
 
 	ASSERT(!mask);
@@ -211,12 +282,48 @@ bool CmdInfo::exec() const
 }
 
 
-static void printSeparator(bool& f_ioFirstFlag)
+bool CmdInfo::exec() const
+{
+	std::vector<std::string> outputs(m_pathsIn.size());
+	std::vector<char> results(m_pathsIn.size());
+
+	try
+	{
+		processFiles(m_pathsIn, getInfoParts(m_fields), [&](size_t f_index, LoadedFile& f_file)
+		{
+			std::ostringstream os;
+			results[f_index] = printInfo(os, f_file, m_fields);
+			outputs[f_index] = os.str();
+			f_file.release();
+		});
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	bool bResult = true;
+	for(size_t i = 0; i < m_pathsIn.size(); ++i)
+	{
+		if(i)
+			LOG("");
+		VERBOSE("Outputting info for \"" << m_pathsIn[i] << '"');
+		std::cout << outputs[i];
+		bResult = bResult && results[i];
+	}
+	std::cout.flush();
+
+	return bResult;
+}
+
+
+static void printSeparator(std::ostream& f_os, bool& f_ioFirstFlag)
 {
 	if(f_ioFirstFlag)
 		f_ioFirstFlag = false;
 	else
-		LOG("===");
+		OUT("===");
 }
 
 
@@ -234,7 +341,7 @@ static std::string makeAlignedCaption(uint f_width, const std::string& f_name, i
 	return str;
 }
 
-static void printFrames(const std::string& f_name, const Tag::IID3v2& f_tag, tag_frame_count_getter_t f_pfnCount, tag_frame_getter_t f_pfnGetter, tag_genre_index_getter_t f_pfnGenreIndex)
+static void printFrames(std::ostream& f_os, const std::string& f_name, const Tag::IID3v2& f_tag, tag_frame_count_getter_t f_pfnCount, tag_frame_getter_t f_pfnGetter, tag_genre_index_getter_t f_pfnGenreIndex)
 {
 	auto nTags = (f_tag.*f_pfnCount)();
 	if(nTags < 2)
@@ -246,7 +353,7 @@ static void printFrames(const std::string& f_name, const Tag::IID3v2& f_tag, tag
 			if(f_pfnGenreIndex)
 				caption = caption + " (" + std::to_string((f_tag.*f_pfnGenreIndex)(0)) + ')';
 		}
-		LOG(caption);
+		OUT(caption);
 	}
 	else
 	{
@@ -255,49 +362,605 @@ static void printFrames(const std::string& f_name, const Tag::IID3v2& f_tag, tag
 			auto caption = makeAlignedCaption(s_captionWidth, f_name, i) + ' ' + (f_tag.*f_pfnGetter)(i);
 			if(f_pfnGenreIndex)
 				caption = caption + " (" + std::to_string((f_tag.*f_pfnGenreIndex)(i)) + ')';
-			LOG(caption);
+			OUT(caption);
 		}
 	}
 }
 
+#undef OUT_WARNING
+#undef OUT
+
 // ====================================
-bool CmdCutFrames::exec() const
+// Input of the commands which modify the MPEG stream only. Tags are not
+// parsed: the ID3v2 tag is only indexed to be validated, and all tags are
+// copied to the output as is
+struct StreamInput
 {
-	std::shared_ptr<IMP3> mp3;
+	std::unique_ptr<MappedFile>		file;
+	Layout							layout;
+	std::shared_ptr<MPEG::IStream>	mpeg;
+};
+
+
+static bool openStream(const std::string& f_path, bool f_force, StreamInput& f_out)
+{
+	std::unique_ptr<LazyID3v2> id3v2;
 	try
 	{
-		mp3 = IMP3::create(m_pathIn);
+		f_out.file = std::make_unique<MappedFile>(f_path);
+		auto data = f_out.file->data();
+		auto& layout = f_out.layout;
+		layout = Layout::probe(data, f_out.file->size());
+		if(layout.id3v2Size)
+			id3v2 = LazyID3v2::create(data + layout.id3v2Offset, layout.id3v2Size);
+		f_out.mpeg = MPEG::IStream::create(data + layout.mpegOffset, layout.mpegSize);
 	}
-	catch(IMP3::exception& e)
+	catch(const std::exception& e)
 	{
 		ERROR(e.what());
 		return false;
 	}
-	if(mp3->hasIssues())
+	if(!f_out.mpeg)
 	{
-		if(m_force)
-			WARNING("the \"" << m_pathIn << "\" has issues");
+		ERROR("no MPEG stream in the \"" << f_path << '"');
+		return false;
+	}
+	if(f_out.layout.hasIssues() || f_out.mpeg->hasIssues() || (id3v2 && id3v2->hasIssues()))
+	{
+		if(f_force)
+			WARNING("the \"" << f_path << "\" has issues");
 		else
 		{
-			ERROR("the \"" << m_pathIn << "\" has issues - specify \"-f\" option to override");
+			ERROR("the \"" << f_path << "\" has issues - specify \"-f\" option to override");
 			return false;
 		}
 	}
 
+	return true;
+}
+
+
+static size_t getStreamSize(const MPEG::IStream& f_stream)
+{
+	size_t size = 0;
+	for(unsigned i = 0, n = f_stream.getFrameCount(); i < n; ++i)
+		size += f_stream.getFrameSize(i);
+	return size;
+}
+
+
+// The f_fixup is applied to the serialized MPEG stream. The f_streamHead (e.g.
+// a new Xing frame) is written before the stream after the f_fixup.
+// With the f_plan nothing is written: the output is built in memory and its
+// I/O is printed as JSON
+static bool writeStream(const std::string& f_pathIn, const std::string& f_pathOut, bool f_force, bool f_plan,
+						const StreamInput& f_in,
+						const std::function<void(std::vector<unsigned char>&)>& f_fixup = nullptr,
+						const std::vector<unsigned char>* f_streamHead = nullptr)
+{
+	auto pathOut = f_pathOut.empty() ? f_pathIn : f_pathOut;
+	if(!f_force && (pathOut == f_pathIn))
+	{
+		ERROR("trying to overwrite the input file - either specify \"-f\" option to force overwrite or \"-o <file>\" to specify an output file");
+		return false;
+	}
+
+	try
+	{
+		// The buffer is reserved for the remaining frames, so the stream is
+		// serialized without reallocations
+		PooledBuffer buffer(getStreamSize(*f_in.mpeg));
+		auto& stream = buffer.get();
+		f_in.mpeg->serialize(stream);
+		if(f_fixup)
+			f_fixup(stream);
+
+		auto data = f_in.file->data();
+		auto& layout = f_in.layout;
+		ByteView head = {nullptr, 0};
+		if(f_streamHead)
+			head = {f_streamHead->data(), f_streamHead->size()};
+
+		// The output is matched with the input only if it may be patched in
+		auto outSize = layout.id3v2Size + head.size + stream.size() + layout.trailerSize();
+		bool bSameFile = (pathOut == f_pathIn) && (outSize == layout.fileSize);
+		std::vector<OutputPiece> pieces;
+		if(f_plan || bSameFile)
+			pieces = planOutput(data, layout, head, stream);
+		bool bInPlace = bSameFile && isInPlace(pieces, data, layout);
+
+		if(f_plan)
+			std::cout << formatPlan(f_pathIn, pathOut, layout.fileSize, pieces, bInPlace) << std::endl;
+		else if(bInPlace)
+		{
+			std::vector<FilePatch> patches;
+			for(auto& piece : pieces)
+			{
+				if(!piece.bCopied)
+					patches.push_back({piece.offset, piece.bytes});
+			}
+			patchFile(pathOut, patches);
+			LOG("File \"" << pathOut << "\" sucsessfully updated in place");
+		}
+		else
+		{
+			writeFileAtomic(pathOut, {{data + layout.id3v2Offset, layout.id3v2Size},
+									  head,
+									  {stream.data(), stream.size()},
+									  {data + layout.trailerOffset(), layout.trailerSize()}});
+			LOG("File \"" << pathOut << "\" sucsessfully " << ((pathOut == f_pathIn) ? "overwritten" : "created"));
+		}
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	return true;
+}
+
+// ====================================
+// Write the gapless delay and padding into the Xing frame at the beginning of
+// the f_ioStream and update its counts and TOC. If the f_xing is false or the
+// Xing frame has no room for a LAME tag, a new Xing frame is made into the
+// f_outHead and replaces the old one.
+// Throws std::runtime_error
+static void writeGaplessInfo(std::vector<unsigned char>& f_ioStream, bool f_xing, bool f_vbr,
+							 unsigned f_delay, unsigned f_padding, std::vector<unsigned char>& f_outHead)
+{
+	FrameHeader header;
+	if(f_ioStream.size() < FrameHeader::headerSize || !FrameHeader::parse(f_ioStream.data(), header))
+		throw std::runtime_error("the output stream doesn't start with a frame");
+
+	unsigned char* frame = nullptr;
+	size_t frameSize = 0;
+	XingHeader xing;
+	LameTag tag;
+	if(f_xing)
+	{
+		frame = f_ioStream.data();
+		frameSize = std::min<size_t>(header.size, f_ioStream.size());
+		if(!XingHeader::parse(frame, frameSize, xing))
+			throw std::runtime_error("the Xing header is not found in the output stream");
+		if(!LameTag::parse(frame, frameSize, xing, tag) && !LameTag::create(frame, frameSize, xing, tag))
+		{
+			// The bytes after the Xing header belong to another encoder
+			f_ioStream.erase(f_ioStream.begin(), f_ioStream.begin() + frameSize);
+			f_xing = false;
+			if(f_ioStream.size() < FrameHeader::headerSize)
+				throw std::runtime_error("the output stream has no audio frames");
+		}
+	}
+	if(!f_xing)
+	{
+		f_outHead = makeXingFrame(f_ioStream.data(), f_vbr);
+		if(f_outHead.empty())
+			throw std::runtime_error("failed to make a Xing frame for the gapless information");
+		frame = f_outHead.data();
+		frameSize = f_outHead.size();
+		XingHeader::parse(frame, frameSize, xing);
+		LameTag::parse(frame, frameSize, xing, tag);
+	}
+
+	const unsigned char* music = f_xing ? frame + frameSize : f_ioStream.data();
+	size_t musicSize = f_xing ? f_ioStream.size() - frameSize : f_ioStream.size();
+	auto table = FrameTable::walk(music, musicSize);
+	xing.frames	= table.getFrameCount();
+	xing.bytes	= frameSize + musicSize;
+	if(xing.flags & XingHeader::Flags::TOC)
+		xing.buildTOC(table, frameSize);
+	xing.write(frame);
+
+	tag.delay		= f_delay;
+	tag.padding		= f_padding;
+	tag.musicLength	= frameSize + musicSize;
+	tag.write(frame, music, musicSize);
+}
+
+// ====================================
+bool CmdCutFrames::exec() const
+{
+	StreamInput in;
+	if( !openStream(m_pathIn, m_force, in) )
+		return false;
+
 	VERBOSE("Cutting out " << m_count << " frames starting from the frame #" << m_frame <<
 			" from the \"" << m_pathIn << '"');
 
+	auto& mpeg = *in.mpeg;
+	auto data = in.file->data() + in.layout.mpegOffset;
+	auto table = FrameTable::walk(data, in.layout.mpegSize);
+
+	// The gapless information of a Xing frame is kept
+	unsigned nFrames = table.getFrameCount();
+	XingHeader xing;
+	LameTag tag = {0, 0, 0, 0};
+	bool bXing = nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing);
+	if(bXing)
+		LameTag::parse(data + table.offsets[0], table.sizes[0], xing, tag);
+
+	ReservoirBridge bridge;
+	auto count = m_count;
+	int first = -1;
+	if(m_frame < mpeg.getFrameCount())
+	{
+		count = std::min(m_count, mpeg.getFrameCount() - m_frame);
+		first = table.findFrame(mpeg.getFrameOffset(m_frame));
+		if(first >= 0)
+			count = bridgeReservoir(data, table, first, count, bridge);
+		else
+			WARNING("the bit reservoir can't be checked - the frames can't be matched with the MPEG stream");
+	}
+	if(bridge.count)
+		VERBOSE("The frame after the cut refers to " << bridge.bytes << " bytes of the bit reservoir - " <<
+				bridge.count << " preceding frame(s) are kept as silent bridging frames");
+
+	unsigned nCut = 0;
 	try
 	{
-		auto nCut = mp3->mpegStream()->cut(m_frame, m_count);
-		ASSERT(nCut <= m_count);
+		nCut = count ? mpeg.cut(m_frame, count) : 0;
+		ASSERT(nCut <= count);
 		if(!nCut)
 		{
-			ERROR("no frames has been cut out");
+			if(!bridge.count)
+			{
+				ERROR("no frames has been cut out");
+				return false;
+			}
+			// The bridging frames take the whole range
+			if(!m_force)
+			{
+				ERROR("no frames can be cut out, the " << bridge.count << " frame(s) would be silenced only - specify \"-f\" option to silence them");
+				return false;
+			}
+			WARNING("no frames are cut out, " << bridge.count << " frame(s) are silenced");
+		}
+		else if(nCut + bridge.count < m_count)
+			WARNING("the actual number of frames cut out (" << nCut << ") and silenced (" << bridge.count << ") is less than requested");
+	}
+	catch(const std::out_of_range& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	// The samples of the frames cut out at the beginning or the end are
+	// skipped no more
+	unsigned delay = tag.delay;
+	unsigned padding = tag.padding;
+	FrameHeader header;
+	if(bXing && (first > 0) && FrameHeader::parse(data + table.offsets[first], header))
+	{
+		uint64_t samples = static_cast<uint64_t>(nCut) * header.samples;
+		if(first == 1)
+			delay = (delay > samples) ? delay - samples : 0;
+		if(first + nCut == nFrames)
+			padding = (padding > samples) ? padding - samples : 0;
+	}
+
+	bool bVBR = mpeg.isVBR();
+	std::vector<unsigned char> xingFrame;
+	return writeStream(m_pathIn, m_pathOut, m_force, m_plan, in, [&](std::vector<unsigned char>& f_stream)
+	{
+		applyReservoirBridge(f_stream, bridge, data, table);
+		// Unless the Xing frame itself is cut out
+		XingHeader out;
+		if(bXing && XingHeader::parse(f_stream.data(), f_stream.size(), out))
+			writeGaplessInfo(f_stream, true, bVBR, delay, padding, xingFrame);
+	}, &xingFrame);
+}
+
+// ====================================
+// Quantized +-1 values at this gain are about 90 dB below the full scale
+static const unsigned s_silentGlobalGain = 150;
+
+
+// Return the stream frame index of the walker frame f_first or -1 unless the
+// walker frames from the f_first on are the last frames of the MPEG stream
+static int matchStreamFrames(const MPEG::IStream& f_mpeg, const FrameTable& f_table, unsigned f_first)
+{
+	unsigned nFrames = f_table.getFrameCount();
+	unsigned nStream = f_mpeg.getFrameCount();
+	if((f_first >= nFrames) || (nFrames - f_first > nStream))
+		return -1;
+
+	unsigned iFirst = nStream - (nFrames - f_first);
+	for(unsigned i = f_first; i < nFrames; ++i)
+	{
+		if(f_mpeg.getFrameOffset(iFirst + i - f_first) != f_table.offsets[i])
+			return -1;
+	}
+	return iFirst;
+}
+
+
+bool CmdTrimSilence::exec() const
+{
+	StreamInput in;
+	if( !openStream(m_pathIn, m_force, in) )
+		return false;
+
+	auto data = in.file->data() + in.layout.mpegOffset;
+	auto table = FrameTable::walk(data, in.layout.mpegSize);
+	unsigned nFrames = table.getFrameCount();
+
+	auto isSilent = [&data, &table](unsigned f_index)
+	{
+		auto frame = data + table.offsets[f_index];
+		FrameHeader header;
+		SideInfo info;
+		return FrameHeader::parse(frame, header) &&
+			   SideInfo::parse(frame, table.sizes[f_index], header, info) &&
+			   info.isSilent(s_silentGlobalGain);
+	};
+
+	// The Xing/Info frame carries no audio and must stay in place
+	unsigned first = 0;
+	XingHeader xing;
+	LameTag tag = {0, 0, 0, 0};
+	bool bXing = nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing);
+	if(bXing)
+	{
+		first = 1;
+		LameTag::parse(data + table.offsets[0], table.sizes[0], xing, tag);
+	}
+
+	unsigned begin = first;
+	while((begin < nFrames) && isSilent(begin))
+		++begin;
+	unsigned end = nFrames;
+	while((end > begin) && isSilent(end - 1))
+		--end;
+
+	if(begin == nFrames)
+	{
+		ERROR("the \"" << m_pathIn << "\" has no frames other than silence");
+		return false;
+	}
+
+	unsigned nLeading = begin - first;
+	unsigned nTrailing = nFrames - end;
+	if(!nLeading && !nTrailing)
+	{
+		VERBOSE("No silence to trim in the \"" << m_pathIn << '"');
+		return true;
+	}
+
+	FrameHeader header;
+	FrameHeader::parse(data + table.offsets[0], header);
+	float frameTime = static_cast<float>(header.samples) / header.samplingRate;
+	VERBOSE("Trimming " << nLeading << " leading (" << nLeading * frameTime << " sec) and " <<
+			nTrailing << " trailing (" << nTrailing * frameTime << " sec) silent frames from the \"" << m_pathIn << '"');
+
+	// The walker and the MPEG stream must agree on the frames
+	auto& mpeg = *in.mpeg;
+	int iFirst = matchStreamFrames(mpeg, table, first);
+	if(iFirst < 0)
+	{
+		ERROR("the frames of the \"" << m_pathIn << "\" can't be matched with the MPEG stream");
+		return false;
+	}
+
+	ReservoirBridge bridge;
+	auto nCut = bridgeReservoir(data, table, first, nLeading, bridge);
+	if(bridge.count)
+		VERBOSE("The first audible frame refers to " << bridge.bytes << " bytes of the bit reservoir - " <<
+				bridge.count << " preceding silent frame(s) are kept");
+
+	try
+	{
+		// Truncate first so that the leading frame indices stay valid
+		if(nTrailing && (mpeg.truncate(nTrailing) != nTrailing))
+		{
+			ERROR("failed to truncate " << nTrailing << " frames");
+			return false;
+		}
+		if(nCut && (mpeg.cut(iFirst, nCut) != nCut))
+		{
+			ERROR("failed to cut out " << nCut << " frames");
+			return false;
+		}
+	}
+	catch(const std::out_of_range& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	// The encoder delay and padding are within the trimmed frames at most
+	uint64_t spf = header.samples;
+	unsigned delay = (tag.delay > nCut * spf) ? tag.delay - nCut * spf : 0;
+	unsigned padding = (tag.padding > nTrailing * spf) ? tag.padding - nTrailing * spf : 0;
+
+	bool bVBR = mpeg.isVBR();
+	std::vector<unsigned char> xingFrame;
+	return writeStream(m_pathIn, m_pathOut, m_force, m_plan, in, [&](std::vector<unsigned char>& f_stream)
+	{
+		applyReservoirBridge(f_stream, bridge, data, table);
+		if(bXing)
+			writeGaplessInfo(f_stream, true, bVBR, delay, padding, xingFrame);
+	}, &xingFrame);
+}
+
+// ====================================
+uint64_t SamplePosition::getSample(unsigned f_samplingRate) const
+{
+	switch(unit)
+	{
+	case Unit::Seconds:			return std::llround(value * f_samplingRate);
+	case Unit::Milliseconds:	return std::llround(value * f_samplingRate / 1000);
+	case Unit::Samples:			return std::llround(value);
+	}
+	return 0;
+}
+
+
+std::string SamplePosition::str() const
+{
+	std::ostringstream os;
+	os << value;
+	switch(unit)
+	{
+	case Unit::Seconds:			os << " sec";		break;
+	case Unit::Milliseconds:	os << " ms";		break;
+	case Unit::Samples:			os << " samples";	break;
+	}
+	return os.str();
+}
+
+
+bool CmdCutSamples::exec() const
+{
+	StreamInput in;
+	if( !openStream(m_pathIn, m_force, in) )
+		return false;
+
+	auto data = in.file->data() + in.layout.mpegOffset;
+	auto table = FrameTable::walk(data, in.layout.mpegSize);
+	unsigned nFrames = table.getFrameCount();
+
+	// The Xing/Info frame carries no audio and must stay in place
+	unsigned first = 0;
+	XingHeader xing;
+	LameTag tag = {0, 0, 0, 0};
+	bool bXing = nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing);
+	if(bXing)
+	{
+		first = 1;
+		LameTag::parse(data + table.offsets[0], table.sizes[0], xing, tag);
+	}
+
+	FrameHeader header;
+	if((first == nFrames) || !FrameHeader::parse(data + table.offsets[first], header))
+	{
+		ERROR("the \"" << m_pathIn << "\" has no audio frames");
+		return false;
+	}
+
+	// The walker and the MPEG stream must agree on the frames
+	auto& mpeg = *in.mpeg;
+	int iFirst = matchStreamFrames(mpeg, table, first);
+	if(iFirst < 0)
+	{
+		ERROR("the frames of the \"" << m_pathIn << "\" can't be matched with the MPEG stream");
+		return false;
+	}
+
+	// Samples of the frames in a row. The playable ones are between the
+	// encoder delay and padding
+	uint64_t spf = header.samples;
+	uint64_t nAudio = nFrames - first;
+	uint64_t total = nAudio * spf;
+	if(tag.delay + tag.padding >= total)
+	{
+		ERROR("the \"" << m_pathIn << "\" has no playable samples");
+		return false;
+	}
+	uint64_t length = total - tag.delay - tag.padding;
+
+	auto begin = m_begin.getSample(header.samplingRate);
+	auto end = std::min(m_end.getSample(header.samplingRate), length);
+	if(begin >= end)
+	{
+		ERROR("nothing to cut between " << m_begin.str() << " and " << m_end.str() <<
+			  " (the stream has " << length << " samples)");
+		return false;
+	}
+	if(!begin && (end == length))
+	{
+		ERROR("the whole stream can't be cut out");
+		return false;
+	}
+
+	VERBOSE("Cutting out samples " << begin << " to " << end << " of " << length << " from the \"" << m_pathIn << '"');
+
+	// The range in the samples of the frames
+	auto rawBegin = tag.delay + begin;
+	auto rawEnd = tag.delay + end;
+
+	// The LAME tag is written to Layer III streams with a bitrate only
+	bool bSampleAccurate = (header.layer == 3) && !header.isFreeFormat();
+
+	unsigned delay = tag.delay;
+	unsigned padding = tag.padding;
+	unsigned cutFirst;	// Audio frame index
+	unsigned nCut;
+	unsigned nTruncate = 0;
+	if(bSampleAccurate && !begin)
+	{
+		// The rest of the frame at the end is skipped by the encoder delay
+		cutFirst = 0;
+		nCut = rawEnd / spf;
+	}
+	else if(bSampleAccurate && (end == length))
+	{
+		// The rest of the frame at the beginning is skipped by the padding
+		cutFirst = 0;
+		nCut = 0;
+		auto nKeep = (rawBegin + spf - 1) / spf;
+		nTruncate = nAudio - nKeep;
+		padding = nKeep * spf - rawBegin;
+	}
+	else
+	{
+		// A gap in the middle of the stream can't be expressed with the
+		// gapless information, so only the whole frames are cut out
+		cutFirst = (rawBegin + spf - 1) / spf;
+		auto cutEnd = rawEnd / spf;
+		if(cutEnd <= cutFirst)
+		{
+			ERROR("no whole frame lies between " << m_begin.str() << " and " << m_end.str());
+			return false;
+		}
+		nCut = cutEnd - cutFirst;
+	}
+
+	ReservoirBridge bridge;
+	if(nCut)
+	{
+		nCut = bridgeReservoir(data, table, first + cutFirst, nCut, bridge);
+		if(bridge.count)
+			VERBOSE("The frame after the cut refers to " << bridge.bytes << " bytes of the bit reservoir - " <<
+					bridge.count << " preceding frame(s) are kept as silent bridging frames");
+	}
+	if(!bSampleAccurate)
+		WARNING("a cut of a Layer I/II or free format stream is frame accurate: samples " << cutFirst * spf - tag.delay <<
+				" to " << (cutFirst + nCut) * spf - tag.delay << " are cut out");
+	else if(begin && (end != length))
+		WARNING("a cut in the middle of the stream is frame accurate: samples " << cutFirst * spf - tag.delay <<
+				" to " << (cutFirst + nCut) * spf - tag.delay << " are cut out");
+	if(bSampleAccurate && !begin)
+	{
+		// The bridging frames are skipped too
+		uint64_t skip = rawEnd - nCut * spf;
+		if(skip > LameTag::maxDelay)
+		{
+			if(!m_force)
+			{
+				ERROR("the encoder delay of " << skip << " samples exceeds the maximum of " << LameTag::maxDelay <<
+					  " - specify \"-f\" option to clamp it");
+				return false;
+			}
+			WARNING("the encoder delay of " << skip << " samples is clamped to " << LameTag::maxDelay);
+			skip = LameTag::maxDelay;
+		}
+		delay = skip;
+	}
+
+	try
+	{
+		// Truncate first so that the leading frame indices stay valid
+		if(nTruncate && (mpeg.truncate(nTruncate) != nTruncate))
+		{
+			ERROR("failed to truncate " << nTruncate << " frames");
+			return false;
+		}
+		if(nCut && (mpeg.cut(iFirst + cutFirst, nCut) != nCut))
+		{
+			ERROR("failed to cut out " << nCut << " frames");
 			return false;
 		}
-		if(nCut < m_count)
-			WARNING("the actual number of frames cut out (" << nCut << ") is less than requested");
 	}
 	catch(const std::out_of_range& e)
 	{
@@ -305,20 +968,486 @@ bool CmdCutFrames::exec() const
 		return false;
 	}
 
-	// Serialize
+	if((delay != tag.delay) || (padding != tag.padding))
+		VERBOSE("Encoder delay " << delay << ", padding " << padding << " samples");
+
+	// A stream without a Xing frame gets one only if there is something to trim
+	bool bGapless = bSampleAccurate && (bXing || delay || padding);
+	bool bVBR = mpeg.isVBR();
+	std::vector<unsigned char> xingFrame;
+	return writeStream(m_pathIn, m_pathOut, m_force, m_plan, in, [&](std::vector<unsigned char>& f_stream)
+	{
+		applyReservoirBridge(f_stream, bridge, data, table);
+		if(bGapless)
+			writeGaplessInfo(f_stream, bXing, bVBR, delay, padding, xingFrame);
+	}, &xingFrame);
+}
+
+// ====================================
+struct TagField
+{
+	const char*	name;
+	// ID3v2.2, ID3v2.3, ID3v2.4 frame IDs
+	const char*	ids[3];
+};
+
+static const TagField s_tagFields[] =
+{
+	{"title",		{"TT2", "TIT2", "TIT2"}},
+	{"artist",		{"TP1", "TPE1", "TPE1"}},
+	{"album",		{"TAL", "TALB", "TALB"}},
+	{"albumartist",	{"TP2", "TPE2", "TPE2"}},
+	{"year",		{"TYE", "TYER", "TDRC"}},
+	{"track",		{"TRK", "TRCK", "TRCK"}},
+	{"disc",		{"TPA", "TPOS", "TPOS"}},
+	{"bpm",			{"TBP", "TBPM", "TBPM"}},
+	{"genre",		{"TCO", "TCON", "TCON"}},
+	{"comment",		{"COM", "COMM", "COMM"}},
+	{"composer",	{"TCM", "TCOM", "TCOM"}},
+	{"publisher",	{"TPB", "TPUB", "TPUB"}},
+	{"origartist",	{"TOA", "TOPE", "TOPE"}},
+	{"copyright",	{"TCR", "TCOP", "TCOP"}},
+	{"encoded",		{"TEN", "TENC", "TENC"}}
+};
+
+static const TagField* findTagField(const std::string& f_name)
+{
+	for(auto& field : s_tagFields)
+	{
+		if(f_name == field.name)
+			return &field;
+	}
+	return nullptr;
+}
+
+
+bool CmdEditTags::isField(const std::string& f_name)
+{
+	return findTagField(f_name);
+}
+
+
+// Return false if the ID3v1 tag has no such field
+static bool setID3v1Field(Tag::IID3v1& f_tag, const std::string& f_name, const std::string& f_value)
+{
+	if(f_name == "title")
+		f_tag.setTitle(f_value);
+	else if(f_name == "artist")
+		f_tag.setArtist(f_value);
+	else if(f_name == "album")
+		f_tag.setAlbum(f_value);
+	else if(f_name == "year")
+		f_tag.setYear(f_value);
+	else if(f_name == "comment")
+		f_tag.setComment(f_value);
+	else if(f_name == "track")
+		f_tag.setTrack(f_value.empty() ? 0 : std::stoul(f_value));
+	else if(f_name == "genre")
+	{
+		auto index = Tag::genre(f_value);
+		if(index < 0)
+			throw std::invalid_argument("unknown ID3v1 genre \"" + f_value + '"');
+		f_tag.setGenreIndex(index);
+	}
+	else
+		return false;
+
+	return true;
+}
+
+
+bool CmdEditTags::exec() const
+{
+	std::unique_ptr<MappedFile> file;
+	Layout layout;
+	std::unique_ptr<LazyID3v2> id3v2;
+	std::shared_ptr<Tag::IID3v1> id3v1;
+	try
+	{
+		file = std::make_unique<MappedFile>(m_pathIn);
+		layout = Layout::probe(file->data(), file->size());
+		if(layout.id3v2Size)
+			id3v2 = LazyID3v2::create(file->data() + layout.id3v2Offset, layout.id3v2Size);
+		else
+			id3v2 = LazyID3v2::create();
+		if(layout.id3v1Size)
+			id3v1 = Tag::IID3v1::create(file->data(), layout.id3v1Offset, file->size());
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	// The tag covers the rest of the file, so neither a patch nor a rewrite
+	// would keep the audio
+	if(layout.id3v2Overrun)
+	{
+		ERROR("the ID3v2 tag size of the \"" << m_pathIn << "\" exceeds the file size - the tags can't be edited");
+		return false;
+	}
+
+	if(layout.hasIssues() || id3v2->hasIssues())
+	{
+		if(m_force)
+			WARNING("the \"" << m_pathIn << "\" has issues");
+		else
+		{
+			ERROR("the \"" << m_pathIn << "\" has issues - specify \"-f\" option to override");
+			return false;
+		}
+	}
+
+	VERBOSE("Editing tags of the \"" << m_pathIn << '"');
+
+	try
+	{
+		auto version = id3v2->getMinorVersion();
+		for(auto& field : m_fields)
+		{
+			auto tagField = findTagField(field.first);
+			ASSERT(tagField);
+			id3v2->setText(tagField->ids[version - 2], field.second);
+			if(id3v1)
+				setID3v1Field(*id3v1, field.first, field.second);
+		}
+	}
+	catch(const std::logic_error& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
 	auto pathOut = m_pathOut.empty() ? m_pathIn : m_pathOut;
 	if(!m_force && (pathOut == m_pathIn))
 	{
 		ERROR("trying to overwrite the input file - either specify \"-f\" option to force overwrite or \"-o <file>\" to specify an output file");
 		return false;
 	}
+	bool bInPlace = (pathOut == m_pathIn) && layout.canPatchID3v2(id3v2->getRequiredSize());
 
 	try
 	{
-		mp3->serialize(pathOut);
-		VERBOSE("File \"" << pathOut << "\" sucsessfully " << ((pathOut == m_pathIn) ? "overwritten" : "created"));
+		auto data = file->data();
+
+		std::vector<unsigned char> bytesID3v1;
+		if(id3v1)
+		{
+			id3v1->serialize(bytesID3v1);
+			ASSERT(bytesID3v1.size() == layout.id3v1Size);
+		}
+
+		auto sizeID3v2 = bInPlace ? layout.id3v2Size : (id3v2->getRequiredSize() + m_padding);
+		PooledBuffer bufferID3v2(sizeID3v2);
+		auto& bytesID3v2 = bufferID3v2.get();
+		id3v2->serialize(bytesID3v2, sizeID3v2);
+
+		// The ID3v2 tag is patched first. Each patch is synced before the
+		// next one, so a failure leaves the file with consistent tags
+		if(bInPlace)
+		{
+			std::vector<FilePatch> patches = {{layout.id3v2Offset, {bytesID3v2.data(), bytesID3v2.size()}}};
+			if(id3v1)
+				patches.push_back({layout.id3v1Offset, {bytesID3v1.data(), bytesID3v1.size()}});
+
+			// Release the mapping before the file is modified
+			file.reset();
+			patchFile(pathOut, patches);
+			VERBOSE("Tags of the \"" << pathOut << "\" sucsessfully updated in place");
+		}
+		else
+		{
+			auto rest = layout.id3v2Offset + layout.id3v2Size;
+			std::vector<ByteView> pieces = {{data, layout.id3v2Offset},
+											{bytesID3v2.data(), bytesID3v2.size()}};
+			if(id3v1)
+			{
+				pieces.push_back({data + rest, layout.id3v1Offset - rest});
+				pieces.push_back({bytesID3v1.data(), bytesID3v1.size()});
+				rest = layout.id3v1Offset + layout.id3v1Size;
+			}
+			pieces.push_back({data + rest, layout.fileSize - rest});
+
+			writeFileAtomic(pathOut, pieces);
+			VERBOSE("File \"" << pathOut << "\" sucsessfully " << ((pathOut == m_pathIn) ? "rewritten" : "created") <<
+					" with " << m_padding << " bytes of ID3v2 padding");
+		}
 	}
-	catch(IMP3::exception& e)
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	return true;
+}
+
+// ====================================
+// The same check as the cut command performs
+static void verifyStream(const LoadedFile& f_file, std::vector<std::string>& f_ioIssues)
+{
+	try
+	{
+		auto mpeg = MPEG::IStream::create(f_file.mpeg.data, f_file.mpeg.size);
+		if(!mpeg || mpeg->hasIssues())
+			f_ioIssues.push_back("the MPEG stream parser reports issues");
+	}
+	catch(const std::exception& e)
+	{
+		f_ioIssues.push_back(e.what());
+	}
+}
+
+
+bool CmdVerify::exec() const
+{
+	struct Report
+	{
+		bool						readable;
+		unsigned					frames;
+		std::vector<std::string>	issues;
+	};
+	std::vector<Report> reports(m_pathsIn.size());
+
+	// A single file is checked with parallel frames, a batch with parallel files
+	bool bSingle = (m_pathsIn.size() == 1);
+	auto parts = LoadedFile::Parts::ID3v2 | LoadedFile::Parts::MPEG;
+	try
+	{
+		processFiles(m_pathsIn, parts, [&](size_t f_index, LoadedFile& f_file)
+		{
+			auto& report = reports[f_index];
+			report.readable = verifyFile(f_file, bSingle, report.frames, report.issues);
+			if(report.frames)
+				verifyStream(f_file, report.issues);
+			// Release the file data as soon as possible
+			f_file.release();
+		});
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	unsigned nSafe = 0;
+	for(size_t i = 0; i < m_pathsIn.size(); ++i)
+	{
+		auto& report = reports[i];
+		if(report.issues.empty())
+		{
+			++nSafe;
+			LOG(m_pathsIn[i] << ": OK (" << report.frames << " frames)");
+			continue;
+		}
+
+		if(report.readable)
+			LOG(m_pathsIn[i] << ": " << report.issues.size() << " issue(s) in " << report.frames << " frames");
+		else
+			LOG(m_pathsIn[i] << ": unreadable");
+		for(auto& issue : report.issues)
+			LOG("  " << issue);
+	}
+
+	if(m_pathsIn.size() > 1)
+		VERBOSE(nSafe << " of " << m_pathsIn.size() << " files are safe to cut");
+
+	return nSafe == m_pathsIn.size();
+}
+
+// ====================================
+// Content defined segments of about 64 frames (1.7 sec at 44.1 kHz): a
+// segment ends after a frame whose hash has the low bits zeroed. Copies
+// with trimmed ends share the segments in between
+static const uint64_t	s_segmentMask		= 0x3F;
+static const unsigned	s_segmentMinFrames	= 16;
+static const unsigned	s_segmentMaxFrames	= 256;
+
+
+static std::string hexHash(uint64_t f_hash)
+{
+	char str[17];
+	snprintf(str, sizeof(str), "%016llx", static_cast<unsigned long long>(f_hash));
+	return str;
+}
+
+
+// One NDJSON line
+static std::string hashFile(const LoadedFile& f_file, bool f_segments)
+{
+	std::ostringstream os;
+	os << "{\"path\":" << quoteJSON(f_file.path);
+	if(!f_file.error.empty())
+	{
+		os << ",\"error\":" << quoteJSON(f_file.error) << '}';
+		return os.str();
+	}
+
+	// Only complete audio frames are hashed: junk and the Xing frame differ
+	// between copies of the same audio
+	auto data = f_file.mpeg.data;
+	auto table = FrameTable::walk(data, f_file.mpeg.size);
+	unsigned nFrames = table.getFrameCount();
+	XingHeader xing;
+	unsigned first = (nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing)) ? 1 : 0;
+
+	Hash64 hash;
+	for(auto i = first; i < nFrames; ++i)
+		hash.update(data + table.offsets[i], table.sizes[i]);
+
+	os << ",\"offset\":" << f_file.layout.mpegOffset << ",\"size\":" << f_file.layout.mpegSize <<
+		  ",\"frames\":" << nFrames - first << ",\"hash\":\"" << hexHash(hash.digest()) << '"';
+
+	if(f_segments)
+	{
+		// A segment hash is the hash of its frame hashes
+		os << ",\"segments\":[";
+		Hash64 segment;
+		unsigned n = 0;
+		for(auto i = first; i < nFrames; ++i)
+		{
+			auto frameHash = Hash64::calc(data + table.offsets[i], table.sizes[i]);
+			unsigned char bytes[8];
+			for(unsigned b = 0; b < 8; ++b)
+				bytes[b] = (frameHash >> (8 * b)) & 0xFF;
+			segment.update(bytes, sizeof(bytes));
+			++n;
+
+			bool bLast = (i + 1 == nFrames);
+			if(bLast || (n >= s_segmentMaxFrames) || ((n >= s_segmentMinFrames) && !(frameHash & s_segmentMask)))
+			{
+				auto begin = i + 1 - n;
+				os << ((begin == first) ? "" : ",") << "{\"frame\":" << begin - first <<
+					  ",\"frames\":" << n << ",\"hash\":\"" << hexHash(segment.digest()) << "\"}";
+				segment = Hash64();
+				n = 0;
+			}
+		}
+		os << ']';
+	}
+
+	os << '}';
+	return os.str();
+}
+
+
+bool CmdHash::exec() const
+{
+	std::mutex mutex;
+	bool bResult = true;
+
+	// Lines are printed as soon as files are hashed, i.e. not in order
+	try
+	{
+		processFiles(m_pathsIn, LoadedFile::Parts::MPEG, [&](size_t, LoadedFile& f_file)
+		{
+			auto line = hashFile(f_file, m_segments);
+			bool bError = !f_file.error.empty();
+			f_file.release();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			std::cout << line << '\n';
+			if(bError)
+				bResult = false;
+		});
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+	std::cout.flush();
+
+	return bResult;
+}
+
+// ====================================
+bool CmdStatsFrames::exec() const
+{
+	std::mutex mutex;
+	bool bResult = true;
+
+	// Lines are printed as soon as files are processed, i.e. not in order
+	try
+	{
+		processFiles(m_pathsIn, LoadedFile::Parts::MPEG, [&](size_t, LoadedFile& f_file)
+		{
+			auto line = getFrameStats(f_file);
+			bool bError = !f_file.error.empty();
+			f_file.release();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			std::cout << line << '\n';
+			if(bError)
+				bResult = false;
+		});
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+	std::cout.flush();
+
+	return bResult;
+}
+
+// ====================================
+bool CmdSeekIndex::exec() const
+{
+	auto pathOut = m_pathOut.empty() ? SeekIndex::getPath(m_pathIn) : m_pathOut;
+	if(pathOut == m_pathIn)
+	{
+		ERROR("trying to overwrite the input file with its seek index");
+		return false;
+	}
+
+	try
+	{
+		MappedFile file(m_pathIn);
+		auto index = SeekIndex::build(file.data(), file.size(), m_intervalMs);
+		writeFileAtomic(pathOut, {{index.data(), index.size()}});
+		VERBOSE("Seek index of the \"" << m_pathIn << "\" with " << (index.size() - SeekIndex::headerSize) / SeekIndex::entrySize <<
+				" entries every " << m_intervalMs << " ms written to the \"" << pathOut << '"');
+	}
+	catch(const std::exception& e)
+	{
+		ERROR(e.what());
+		return false;
+	}
+
+	return true;
+}
+
+
+bool CmdSeek::exec() const
+{
+	// Either the index itself or the MP3 file with the index next to it
+	static const std::string s_suffix = SeekIndex::getPath("");
+	bool bIndex = (m_pathIn.size() > s_suffix.size()) &&
+				  !m_pathIn.compare(m_pathIn.size() - s_suffix.size(), s_suffix.size(), s_suffix);
+	auto path = bIndex ? m_pathIn : SeekIndex::getPath(m_pathIn);
+
+	try
+	{
+		SeekIndex index(path);
+
+		struct stat st;
+		if(!bIndex && !stat(m_pathIn.c_str(), &st) && (static_cast<uint64_t>(st.st_size) != index.getFileSize()))
+			WARNING("the size of the \"" << m_pathIn << "\" has changed since the \"" << path << "\" was built");
+
+		SeekIndex::Entry entry;
+		if(!index.lookup(m_position.getSample(index.getSamplingRate()), entry))
+		{
+			ERROR("the seek index \"" << path << "\" is empty");
+			return false;
+		}
+
+		VERBOSE("The frame at sample " << entry.sample << " (" << static_cast<double>(entry.sample) / index.getSamplingRate() <<
+				" sec) starts @ offset " << entry.offset << " (0x" << OUT_HEX(entry.offset) << ')');
+		LOG(entry.offset);
+	}
+	catch(const std::exception& e)
 	{
 		ERROR(e.what());
 		return false;
@@ -339,9 +1468,17 @@ bool CmdHelp::exec() const
 		" [" << B("-fh") << ']' <<
 		" [" << B("-c") << ' ' << U("frame") << ' ' << U("count") << ']' <<
 		" [" << B("-C") << ' ' << U("begin") << ' ' << U("end") << ']' <<
-		" [" << B("-i") << " [mpeg id3v1 id3v2 ape lyrics]]" <<
+		" [" << B("-i") << " [mpeg id3v1 id3v2 ape lyrics] [" << U("file") << " ...]]" <<
 		" [" << B("-o") << ' ' << U("file") << ']' <<
-		" [" << B("-t") << ' ' << U("count") << ']' <<
+		" [" << B("--set") << ' ' << U("field") << '=' << U("value") << " ...]" <<
+		" [" << B("--padding") << ' ' << U("size") << ']' <<
+		" [" << B("--plan") << ']' <<
+		" [" << B("--verify") << " [" << U("file") << " ...]]" <<
+		" [" << B("--hash") << " [segments] [" << U("file") << " ...]]" <<
+		" [" << B("--stats-frames") << " [" << U("file") << " ...]]" <<
+		" [" << B("--seek-index") << " [" << U("ms") << "]]" <<
+		" [" << B("--seek") << ' ' << U("position") << ']' <<
+		" [" << B("--trim-silence") << ']' <<
 		' ' << U("file"));
 	LOG("");
 	LOG( B("DESCRIPTION") );
@@ -351,11 +1488,19 @@ bool CmdHelp::exec() const
 	LOG("");
 	// c
 	LOG(B("-c") << ' ' << U("frame") << ' ' << U("count"));
-	LOG("	Cut (erase) " << U("count") << " frames starting from the " << U("frame") << ". The " << U("frame") << " is zero-based.");
+	LOG("	Cut (erase) " << U("count") << " frames starting from the " << U("frame") << ". The " << U("frame") << " is zero-based. "
+		"Cut out frames which hold the bit reservoir of the frame after the cut are kept as silent frames. "
+		"If they take the whole range, nothing is cut out and the frames are silenced with " << B("-f") << " only. "
+		"The counts, TOC and LAME tag of a Xing/Info frame are updated, the encoder delay and padding are reduced by the samples of the frames cut out at the beginning or the end.");
 	LOG("");
 	// C
 	LOG(B("-C") << ' ' << U("begin") << ' ' << U("end"));
-	LOG("	Cut (erase) frames between the " << U("begin") << " second inclusively and the " << U("end") << " second exclusively.");
+	LOG("	Cut (erase) samples between the " << U("begin") << " inclusively and the " << U("end") << " exclusively. "
+		"A position is a number of seconds optionally followed by \"s\", milliseconds followed by \"ms\" or samples followed by \"smp\", e.g. 1.5, 1.5s, 1500ms or 66150smp. "
+		"Positions count the samples which are played, i.e. without the encoder delay and padding. "
+		"A cut at the beginning or the end of a Layer III stream is sample accurate: the frames around the range are cut out and the rest of the samples is trimmed "
+		"by gapless players with the encoder delay and padding of the LAME tag, which is added if there is none. A cut in the middle of the stream and any cut of a Layer I/II or free format stream is frame accurate. "
+		"An encoder delay which exceeds 4095 samples, e.g. due to the bridging frames, is clamped with " << B("-f") << " only.");
 	LOG("");
 	// f
 	LOG(B("-f"));
@@ -366,20 +1511,60 @@ bool CmdHelp::exec() const
 	LOG("	Print help.");
 	LOG("");
 	// i
-	LOG(B("-i") << " [mpeg id3v1 id3v2 ape lyrics]");
-	LOG("	Print metadata information.");
+	LOG(B("-i") << " [mpeg id3v1 id3v2 ape lyrics] [" << U("file") << " ...]");
+	LOG("	Print metadata information of one or more files. Only the parts of a file which are needed for the requested fields are read.");
 	LOG("");
 	// o
 	LOG(B("-o") << ' ' << U("file"));
 	LOG("	Write a result of processing to " << U("file") << ". A corresponding output file is overwritten if " << U("-f") << " is specified.");
 	LOG("");
-	// t
-	LOG(B("-t") << ' ' << U("count"));
-	LOG("	Cut " << U("count") << " trailing frames (truncate).");
-
-	// -? ? - trim
-
-	// zero indexed
+	// set
+	LOG(B("--set") << ' ' << U("field") << '=' << U("value"));
+	LOG("	Set a tag " << U("field") << " (title, artist, album, albumartist, year, track, disc, bpm, genre, comment, composer, publisher, origartist, copyright, encoded). "
+		"An empty " << U("value") << " removes the field. The option may be repeated. "
+		"The ID3v2 tag is rewritten in place if it fits the current tag size including padding, an existing ID3v1 tag is updated as well. "
+		"The " << U("file") << " is modified with " << B("-f") << " unless " << U("-o") << " is specified.");
+	LOG("");
+	// padding
+	LOG(B("--padding") << ' ' << U("size"));
+	LOG("	Reserve " << U("size") << " bytes of ID3v2 padding when the tag has to grow (4096 by default).");
+	LOG("");
+	// plan
+	LOG(B("--plan"));
+	LOG("	Don't write anything with " << B("-c") << ", " << B("-C") << " or " << B("--trim-silence") << " but print a JSON line with the I/O of the edit: "
+		"the input and output sizes, bytes copied from the input and synthesized (new and modified frames), whether the file is patched in place and the bytes written, "
+		"and the pieces of the output with the input offsets of the copied ones. "
+		"The file is patched in place if it is overwritten with the same size and only the Xing frame changes, e.g. a cut within the encoder delay.");
+	LOG("");
+	// verify
+	LOG(B("--verify") << " [" << U("file") << " ...]");
+	LOG("	Check the integrity of one or more files and print the location of every issue: lost sync, truncated final frame, CRC mismatch, wrong Xing header counts, truncated or overlapping tags. "
+		"A file without issues is safe to cut without " << B("-f") << ". The exit status is 1 if any file has issues.");
+	LOG("");
+	// hash
+	LOG(B("--hash") << " [segments] [" << U("file") << " ...]");
+	LOG("	Print an NDJSON line per file with the XXH64 hash of the audio frames, i.e. without tags, junk and the Xing frame, so copies of the same audio with different tags have the same hash. "
+		"With \"segments\" hashes of content defined segments of about 64 frames are printed too: copies with trimmed ends share the segments in between. "
+		"Files are hashed in parallel and printed in the order of completion.");
+	LOG("");
+	// stats-frames
+	LOG(B("--stats-frames") << " [" << U("file") << " ...]");
+	LOG("	Print a JSON line per file with frame statistics: the bitrate range and histogram, frame size percentiles, bytes per " << s_statsWindowSeconds << " second window, padding and junk bytes. "
+		"Files are processed in parallel and printed in the order of completion.");
+	LOG("");
+	// seek-index
+	LOG(B("--seek-index") << " [" << U("ms") << ']');
+	LOG("	Write a seek index of the " << U("file") << " to " << U("file") << ".seek or the " << B("-o") << " file: absolute byte offsets of the frames every " << U("ms") << " milliseconds (250 by default) for HTTP Range requests.");
+	LOG("");
+	// seek
+	LOG(B("--seek") << ' ' << U("position"));
+	LOG("	Print the byte offset of the frame to start streaming from at the " << U("position") << " (as for " << B("-C") << ") using the seek index of the " << U("file") << ". "
+		"The " << U("file") << " is either an MP3 file with the index next to it or the index itself. The lookup is a binary search over the mapped index.");
+	LOG("");
+	// trim-silence
+	LOG(B("--trim-silence"));
+	LOG("	Cut leading and trailing frames of digital silence. Silent frames are detected from the Layer III side information without decoding. "
+		"The counts, TOC and LAME tag of a Xing/Info frame are updated, the encoder delay and padding are reduced by the samples of the trimmed frames.");
 
 	return true;
 }
@@ -1,8 +1,10 @@
 #pragma once
 
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 class Command
@@ -13,10 +15,15 @@ public:
 
 	void suppressWarnings() { m_force = true; }
 
+	// Print the I/O of the edit as JSON instead of writing anything
+	void			planOnly	();
+	virtual bool	canPlan		() const { return false; }
+
 	virtual bool exec() const = 0;
 
 protected:
-	bool m_force;
+	bool m_force	= false;
+	bool m_plan		= false;
 };
 
 
@@ -43,16 +50,17 @@ public:
 	};
 
 public:
-	CmdInfo(const std::string& f_pathIn, FieldsMask f_fields):
-		m_pathIn(f_pathIn),
+	// Files are loaded with asynchronous I/O and parsed in parallel
+	CmdInfo(const std::vector<std::string>& f_pathsIn, FieldsMask f_fields):
+		m_pathsIn(f_pathsIn),
 		m_fields(f_fields)
 	{}
 
 	bool exec() const final override;
 
 private:
-	std::string	m_pathIn;
-	FieldsMask	m_fields;
+	std::vector<std::string>	m_pathsIn;
+	FieldsMask					m_fields;
 };
 
 
@@ -67,6 +75,7 @@ public:
 		m_count(f_count)
 	{}
 
+	bool canPlan() const final override { return true; }
 	bool exec() const final override;
 
 private:
@@ -77,3 +86,180 @@ private:
 	unsigned	m_count;
 };
 
+
+
+// Position in seconds, milliseconds or samples. On the command line these are
+// a number without a suffix or with "s", with "ms" and with "smp"
+struct SamplePosition
+{
+	enum class Unit
+	{
+		Seconds,
+		Milliseconds,
+		Samples
+	};
+
+	double		value;
+	Unit		unit;
+
+	uint64_t	getSample	(unsigned f_samplingRate) const;
+	std::string	str			() const;
+};
+
+
+class CmdCutSamples final : public Command
+{
+public:
+	// The frames around the range are cut out, the rest of the samples is
+	// trimmed by gapless players with the LAME tag encoder delay and padding
+	CmdCutSamples(const std::string& f_pathIn, const std::string& f_pathOut,
+				  const SamplePosition& f_begin, const SamplePosition& f_end):
+		m_pathIn(f_pathIn),
+		m_pathOut(f_pathOut),
+		m_begin(f_begin),
+		m_end(f_end)
+	{}
+
+	bool canPlan() const final override { return true; }
+	bool exec() const final override;
+
+private:
+	std::string		m_pathIn;
+	std::string		m_pathOut;
+
+	SamplePosition	m_begin;
+	SamplePosition	m_end;
+};
+
+
+class CmdEditTags final : public Command
+{
+public:
+	// A field name ("title", "artist", ...) and a value. An empty value removes the field
+	using Field = std::pair<std::string, std::string>;
+
+	// The ID3v2 tag is rewritten in place when the result fits the current
+	// tag including its padding. Otherwise the file is rewritten and the new
+	// tag reserves f_padding bytes for future edits
+	CmdEditTags(const std::string& f_pathIn, const std::string& f_pathOut,
+				const std::vector<Field>& f_fields, size_t f_padding):
+		m_pathIn(f_pathIn),
+		m_pathOut(f_pathOut),
+		m_fields(f_fields),
+		m_padding(f_padding)
+	{}
+
+	static bool isField(const std::string& f_name);
+
+	bool exec() const final override;
+
+private:
+	std::string			m_pathIn;
+	std::string			m_pathOut;
+
+	std::vector<Field>	m_fields;
+	size_t				m_padding;
+};
+
+
+class CmdVerify final : public Command
+{
+public:
+	// Files are checked in parallel, frames of a single file are checked in parallel
+	explicit CmdVerify(const std::vector<std::string>& f_pathsIn):
+		m_pathsIn(f_pathsIn)
+	{}
+
+	bool exec() const final override;
+
+private:
+	std::vector<std::string>	m_pathsIn;
+};
+
+
+class CmdHash final : public Command
+{
+public:
+	// Files are hashed in parallel
+	CmdHash(const std::vector<std::string>& f_pathsIn, bool f_segments):
+		m_pathsIn(f_pathsIn),
+		m_segments(f_segments)
+	{}
+
+	bool exec() const final override;
+
+private:
+	std::vector<std::string>	m_pathsIn;
+	bool						m_segments;
+};
+
+
+class CmdStatsFrames final : public Command
+{
+public:
+	// Files are processed in parallel
+	explicit CmdStatsFrames(const std::vector<std::string>& f_pathsIn):
+		m_pathsIn(f_pathsIn)
+	{}
+
+	bool exec() const final override;
+
+private:
+	std::vector<std::string>	m_pathsIn;
+};
+
+
+class CmdSeekIndex final : public Command
+{
+public:
+	// The index is written to the f_pathOut or the sidecar of the f_pathIn
+	CmdSeekIndex(const std::string& f_pathIn, const std::string& f_pathOut, unsigned f_intervalMs):
+		m_pathIn(f_pathIn),
+		m_pathOut(f_pathOut),
+		m_intervalMs(f_intervalMs)
+	{}
+
+	bool exec() const final override;
+
+private:
+	std::string	m_pathIn;
+	std::string	m_pathOut;
+	unsigned	m_intervalMs;
+};
+
+
+class CmdSeek final : public Command
+{
+public:
+	// Print the byte offset to start streaming from at the f_position using
+	// the seek index of the f_pathIn
+	CmdSeek(const std::string& f_pathIn, const SamplePosition& f_position):
+		m_pathIn(f_pathIn),
+		m_position(f_position)
+	{}
+
+	bool exec() const final override;
+
+private:
+	std::string		m_pathIn;
+	SamplePosition	m_position;
+};
+
+
+class CmdTrimSilence final : public Command
+{
+public:
+	// Leading and trailing digital silence is detected from the Layer III
+	// side information, i.e. without decoding
+	CmdTrimSilence(const std::string& f_pathIn, const std::string& f_pathOut):
+		m_pathIn(f_pathIn),
+		m_pathOut(f_pathOut)
+	{}
+
+	bool canPlan() const final override { return true; }
+	bool exec() const final override;
+
+private:
+	std::string	m_pathIn;
+	std::string	m_pathOut;
+};
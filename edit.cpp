@@ -0,0 +1,185 @@
+#include "edit.h"
+
+#include "hash.h"
+#include "json.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+
+unsigned bridgeReservoir(const unsigned char* f_data, const FrameTable& f_table,
+						 unsigned f_first, unsigned f_count, ReservoirBridge& f_outBridge)
+{
+	auto next = f_first + f_count;
+	if(next >= f_table.getFrameCount())
+		return f_count;
+
+	auto frame = f_data + f_table.offsets[next];
+	FrameHeader header;
+	SideInfo info;
+	if(!FrameHeader::parse(frame, header) || !SideInfo::parse(frame, f_table.sizes[next], header, info))
+		return f_count;
+
+	f_outBridge.count	= f_table.getReservoirFrames(f_data, next, f_first);
+	f_outBridge.source	= next - f_outBridge.count;
+	f_outBridge.output	= f_first;
+	f_outBridge.bytes	= info.mainDataBegin;
+
+	return f_count - f_outBridge.count;
+}
+
+
+void applyReservoirBridge(std::vector<unsigned char>& f_ioStream, const ReservoirBridge& f_bridge,
+						  const unsigned char* f_data, const FrameTable& f_table)
+{
+	if(!f_bridge.count)
+		return;
+
+	auto out = FrameTable::walk(f_ioStream.data(), f_ioStream.size());
+	for(unsigned i = 0; i < f_bridge.count; ++i)
+	{
+		auto iOut = f_bridge.output + i;
+		auto iIn = f_bridge.source + i;
+		if((iOut >= out.getFrameCount()) || (out.sizes[iOut] != f_table.sizes[iIn]) ||
+		   memcmp(&f_ioStream[out.offsets[iOut]], f_data + f_table.offsets[iIn], f_table.sizes[iIn]))
+			throw std::runtime_error("bridging frames are not found in the output stream");
+
+		silenceFrame(&f_ioStream[out.offsets[iOut]], out.sizes[iOut]);
+	}
+}
+
+// ====================================
+static void addOutputPiece(std::vector<OutputPiece>& f_ioPieces, size_t& f_ioOffset, ByteView f_bytes,
+						   bool f_copied, size_t f_source = 0)
+{
+	if(!f_bytes.size)
+		return;
+
+	// Runs of the adjacent input bytes or the adjacent synthesized ones are merged
+	if(!f_ioPieces.empty())
+	{
+		auto& last = f_ioPieces.back();
+		if(f_copied ? (last.bCopied && (last.source + last.bytes.size == f_source)) :
+					  (!last.bCopied && (last.bytes.data + last.bytes.size == f_bytes.data)))
+		{
+			last.bytes.size += f_bytes.size;
+			f_ioOffset += f_bytes.size;
+			return;
+		}
+	}
+
+	f_ioPieces.push_back({f_ioOffset, f_bytes, f_copied, f_source});
+	f_ioOffset += f_bytes.size;
+}
+
+
+std::vector<OutputPiece> planOutput(const unsigned char* f_data, const Layout& f_layout,
+									ByteView f_head, const std::vector<unsigned char>& f_stream)
+{
+	auto mpeg = f_data + f_layout.mpegOffset;
+
+	std::vector<OutputPiece> pieces;
+	size_t offset = 0;
+	addOutputPiece(pieces, offset, {f_data + f_layout.id3v2Offset, f_layout.id3v2Size}, true, f_layout.id3v2Offset);
+	addOutputPiece(pieces, offset, f_head, false);
+
+	auto in = FrameTable::walk(mpeg, f_layout.mpegSize);
+	auto out = FrameTable::walk(f_stream.data(), f_stream.size());
+	std::unordered_multimap<uint64_t, unsigned> hashes;
+	auto isSame = [&](unsigned f_in, unsigned f_out)
+	{
+		return (in.sizes[f_in] == out.sizes[f_out]) &&
+			   !memcmp(mpeg + in.offsets[f_in], &f_stream[out.offsets[f_out]], out.sizes[f_out]);
+	};
+
+	size_t pos = 0;
+	unsigned next = 0;
+	for(unsigned i = 0; i < out.getFrameCount(); ++i)
+	{
+		auto frame = &f_stream[out.offsets[i]];
+		addOutputPiece(pieces, offset, {&f_stream[pos], out.offsets[i] - pos}, false);
+		pos = out.offsets[i] + out.sizes[i];
+
+		int match = -1;
+		if((next < in.getFrameCount()) && isSame(next, i))
+			match = next;
+		else
+		{
+			if(hashes.empty())
+			{
+				for(unsigned j = 0; j < in.getFrameCount(); ++j)
+					hashes.emplace(Hash64::calc(mpeg + in.offsets[j], in.sizes[j]), j);
+			}
+			auto range = hashes.equal_range(Hash64::calc(frame, out.sizes[i]));
+			for(auto it = range.first; (it != range.second) && (match < 0); ++it)
+			{
+				if(isSame(it->second, i))
+					match = it->second;
+			}
+		}
+
+		if(match < 0)
+			addOutputPiece(pieces, offset, {frame, out.sizes[i]}, false);
+		else
+		{
+			addOutputPiece(pieces, offset, {frame, out.sizes[i]}, true, f_layout.mpegOffset + in.offsets[match]);
+			next = match + 1;
+		}
+	}
+	addOutputPiece(pieces, offset, {f_stream.data() + pos, f_stream.size() - pos}, false);
+
+	addOutputPiece(pieces, offset, {f_data + f_layout.trailerOffset(), f_layout.trailerSize()}, true, f_layout.trailerOffset());
+	return pieces;
+}
+
+
+bool isInPlace(const std::vector<OutputPiece>& f_pieces, const unsigned char* f_data, const Layout& f_layout)
+{
+	auto mpeg = f_data + f_layout.mpegOffset;
+	size_t xingEnd = f_layout.mpegOffset;
+	FrameHeader header;
+	XingHeader xing;
+	if((f_layout.mpegSize >= FrameHeader::headerSize) && FrameHeader::parse(mpeg, header) &&
+	   XingHeader::parse(mpeg, std::min<size_t>(header.size, f_layout.mpegSize), xing))
+		xingEnd += header.size;
+
+	size_t size = 0;
+	for(auto& piece : f_pieces)
+	{
+		if(piece.bCopied ? (piece.source != piece.offset) :
+						   ((piece.offset < f_layout.mpegOffset) || (piece.offset + piece.bytes.size > xingEnd)))
+			return false;
+		size += piece.bytes.size;
+	}
+	return size == f_layout.fileSize;
+}
+
+
+std::string formatPlan(const std::string& f_pathIn, const std::string& f_pathOut, size_t f_fileSize,
+					   const std::vector<OutputPiece>& f_pieces, bool f_inPlace)
+{
+	size_t copied = 0;
+	size_t synthesized = 0;
+	for(auto& piece : f_pieces)
+		(piece.bCopied ? copied : synthesized) += piece.bytes.size;
+
+	std::ostringstream os;
+	os << "{\"path\":" << quoteJSON(f_pathIn) << ",\"output\":" << quoteJSON(f_pathOut) <<
+		  ",\"inputSize\":" << f_fileSize << ",\"outputSize\":" << copied + synthesized <<
+		  ",\"bytesCopied\":" << copied << ",\"bytesSynthesized\":" << synthesized <<
+		  ",\"inPlace\":" << (f_inPlace ? "true" : "false") <<
+		  ",\"bytesWritten\":" << (f_inPlace ? synthesized : copied + synthesized) << ",\"pieces\":[";
+	for(size_t i = 0; i < f_pieces.size(); ++i)
+	{
+		auto& piece = f_pieces[i];
+		os << (i ? "," : "") << "{\"offset\":" << piece.offset << ",\"size\":" << piece.bytes.size;
+		if(piece.bCopied)
+			os << ",\"source\":" << piece.source;
+		os << '}';
+	}
+	os << "]}";
+	return os.str();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+#include "file.h"
+#include "frames.h"
+#include "layout.h"
+
+
+// Layer III frames refer to main data of the preceding frames (the bit
+// reservoir), so the frame after a cut may refer to bytes of cut out frames.
+// The frames holding these bytes are kept in front of the cut and silenced,
+// i.e. they supply the main data but don't produce any audio
+struct ReservoirBridge
+{
+	unsigned	source	= 0;	// Walker index of the first bridging frame in the input
+	unsigned	output	= 0;	// Walker index of the first bridging frame in the output
+	unsigned	count	= 0;
+	unsigned	bytes	= 0;	// main_data_begin of the frame after the cut
+};
+
+
+// Return the number of frames to be actually cut out starting from the
+// walker frame f_first instead of the f_count
+unsigned	bridgeReservoir			(const unsigned char* f_data, const FrameTable& f_table,
+									 unsigned f_first, unsigned f_count, ReservoirBridge& f_outBridge);
+
+// Silence the bridging frames of the output f_ioStream. The f_data and the
+// f_table are the input frames.
+// Throws std::runtime_error if the bridging frames are not in the output
+void		applyReservoirBridge	(std::vector<unsigned char>& f_ioStream, const ReservoirBridge& f_bridge,
+									 const unsigned char* f_data, const FrameTable& f_table);
+
+
+// A run of the output file bytes which are either copied from the input or
+// synthesized (new and modified frames)
+struct OutputPiece
+{
+	size_t		offset;
+	ByteView	bytes;
+	bool		bCopied;
+	size_t		source;		// Input offset of the copied bytes
+};
+
+
+// The output of a stream edit of the input file f_data: the ID3v2 tag, the
+// f_head (e.g. a new Xing frame), the f_stream and the trailing tags. Output
+// frames are matched with the input ones: the next input frame is tried
+// first as the frames keep their order, then any frame with the same hash.
+// Bytes which match no input frame are synthesized
+std::vector<OutputPiece>	planOutput	(const unsigned char* f_data, const Layout& f_layout,
+										 ByteView f_head, const std::vector<unsigned char>& f_stream);
+
+// The output may be patched into the input file: they are the same size, the
+// copied bytes stay in place and only the Xing frame is synthesized. A patch
+// of the audio frames would not be atomic, so they are written to a new file
+bool						isInPlace	(const std::vector<OutputPiece>& f_pieces,
+										 const unsigned char* f_data, const Layout& f_layout);
+
+// One JSON line of the I/O the edit performs
+std::string					formatPlan	(const std::string& f_pathIn, const std::string& f_pathOut, size_t f_fileSize,
+										 const std::vector<OutputPiece>& f_pieces, bool f_inPlace);
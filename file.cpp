@@ -0,0 +1,218 @@
+#include "file.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+
+static std::runtime_error makeError(const std::string& f_what, const std::string& f_path)
+{
+	return std::runtime_error(f_what + " \"" + f_path + "\" (" + strerror(errno) + ')');
+}
+
+
+MappedFile::MappedFile(const std::string& f_path):
+	m_data(nullptr),
+	m_size(0)
+{
+	int fd = open(f_path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw makeError("failed to open", f_path);
+
+	struct stat st;
+	if(fstat(fd, &st))
+	{
+		auto e = makeError("failed to stat", f_path);
+		close(fd);
+		throw e;
+	}
+
+	m_size = st.st_size;
+	if(m_size)
+	{
+		auto p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED)
+		{
+			auto e = makeError("failed to map", f_path);
+			close(fd);
+			throw e;
+		}
+		m_data = static_cast<const unsigned char*>(p);
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+}
+
+
+MappedFile::~MappedFile()
+{
+	if(m_data)
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+
+// ====================================
+// The directory entry of a renamed file is durable once its directory is synced
+static void syncDirectory(const std::string& f_path)
+{
+	auto slash = f_path.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : (slash ? f_path.substr(0, slash) : "/");
+
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if(fd < 0)
+		throw makeError("failed to open", dir);
+	if(fsync(fd))
+	{
+		auto e = makeError("failed to sync", dir);
+		close(fd);
+		throw e;
+	}
+	close(fd);
+}
+
+
+// The mask of the permissions of the files created by the process
+static mode_t getUmask()
+{
+	static const mode_t s_mask = []()
+	{
+		auto mask = umask(0);
+		umask(mask);
+		return mask;
+	}();
+	return s_mask;
+}
+
+
+void writeFileAtomic(const std::string& f_path, const std::vector<ByteView>& f_pieces)
+{
+	// The name is unique, so concurrent writers of the f_path don't share the
+	// file and an existing file is never overwritten
+	auto pathTmp = f_path + ".XXXXXX";
+	int fd = mkstemp(&pathTmp[0]);
+	if(fd < 0)
+		throw makeError("failed to create", pathTmp);
+
+	// A replaced file keeps its permissions and its ownership. Only a
+	// privileged user may give the file away, so that failure is ignored.
+	// A new file gets the permissions of a created one instead of 0600
+	struct stat st;
+	bool bReplaced = !stat(f_path.c_str(), &st);
+	if((bReplaced && fchown(fd, st.st_uid, st.st_gid) && (errno != EPERM)) ||
+	   fchmod(fd, bReplaced ? (st.st_mode & 07777) : (0644 & ~getUmask())))
+	{
+		auto e = makeError("failed to set permissions of", pathTmp);
+		close(fd);
+		unlink(pathTmp.c_str());
+		throw e;
+	}
+
+	// All the pieces are gathered by a single system call per IOV_MAX pieces
+	std::vector<iovec> iovs;
+	iovs.reserve(f_pieces.size());
+	for(auto& piece : f_pieces)
+	{
+		if(piece.size)
+			iovs.push_back({const_cast<unsigned char*>(piece.data), piece.size});
+	}
+
+	for(size_t i = 0; i < iovs.size();)
+	{
+		auto written = writev(fd, &iovs[i], std::min<size_t>(iovs.size() - i, IOV_MAX));
+		if(written < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			auto e = makeError("failed to write", pathTmp);
+			close(fd);
+			unlink(pathTmp.c_str());
+			throw e;
+		}
+
+		// Skip the written pieces and continue a partially written one
+		for(size_t n = written; n;)
+		{
+			auto& iov = iovs[i];
+			if(n < iov.iov_len)
+			{
+				iov.iov_base = static_cast<unsigned char*>(iov.iov_base) + n;
+				iov.iov_len -= n;
+				break;
+			}
+			n -= iov.iov_len;
+			++i;
+		}
+	}
+
+	// The data must be on the disk before the rename makes it visible
+	if(fsync(fd))
+	{
+		auto e = makeError("failed to sync", pathTmp);
+		close(fd);
+		unlink(pathTmp.c_str());
+		throw e;
+	}
+	if(close(fd))
+	{
+		auto e = makeError("failed to write", pathTmp);
+		unlink(pathTmp.c_str());
+		throw e;
+	}
+
+	if(rename(pathTmp.c_str(), f_path.c_str()))
+	{
+		auto e = makeError("failed to replace", f_path);
+		unlink(pathTmp.c_str());
+		throw e;
+	}
+	syncDirectory(f_path);
+}
+
+
+void patchFile(const std::string& f_path, const std::vector<FilePatch>& f_patches)
+{
+	int fd = open(f_path.c_str(), O_WRONLY);
+	if(fd < 0)
+		throw makeError("failed to open", f_path);
+
+	for(auto& patch : f_patches)
+	{
+		auto p = patch.bytes.data;
+		auto n = patch.bytes.size;
+		auto offset = patch.offset;
+		while(n)
+		{
+			auto written = pwrite(fd, p, n, offset);
+			if(written < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				auto e = makeError("failed to write", f_path);
+				close(fd);
+				throw e;
+			}
+			p += written;
+			n -= written;
+			offset += written;
+		}
+
+		if(fsync(fd))
+		{
+			auto e = makeError("failed to sync", f_path);
+			close(fd);
+			throw e;
+		}
+	}
+
+	if(close(fd))
+		throw makeError("failed to write", f_path);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+// Non-owning reference to a byte range
+struct ByteView
+{
+	const unsigned char*	data;
+	size_t					size;
+};
+
+
+// Read-only memory mapped file. Pages are loaded on demand, so regions which
+// are never accessed (e.g. embedded pictures) are never read from the disk.
+class MappedFile final
+{
+public:
+	// Throws std::runtime_error
+	explicit MappedFile(const std::string& f_path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char*	data() const { return m_data; }
+	size_t					size() const { return m_size; }
+
+private:
+	const unsigned char*	m_data;
+	size_t					m_size;
+};
+
+
+// Bytes to be written at the offset of an existing file
+struct FilePatch
+{
+	size_t		offset;
+	ByteView	bytes;
+};
+
+
+// Write the pieces into a uniquely named temporary file next to the f_path
+// and rename it over the f_path. The input may be mapped from the file being replaced.
+// The pieces are gathered with writev(), so they are never copied together.
+// A replaced file keeps its permissions. The file and then its directory
+// are synced, so either the old or the new file survives a crash.
+// Throws std::runtime_error
+void writeFileAtomic(const std::string& f_path, const std::vector<ByteView>& f_pieces);
+
+// Overwrite parts of an existing file in place without changing its size.
+// The patches are written in order and each one is synced before the next,
+// so a failure leaves the preceding patches complete.
+// Throws std::runtime_error
+void patchFile(const std::string& f_path, const std::vector<FilePatch>& f_patches);
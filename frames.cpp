@@ -0,0 +1,592 @@
+#include "frames.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// Bitrates in kbps of MPEG-1 and MPEG-2/2.5 by the layer. The index 0 is
+// the free format
+static const unsigned s_bitratesV1[3][16] =
+{
+	{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+	{0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+	{0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0}
+};
+static const unsigned s_bitratesV2[3][16] =
+{
+	{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+	{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0},
+	{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0}
+};
+
+static const unsigned s_samplingRates[3] = {44100, 48000, 32000};
+
+// Free format frames are searched up to the size at this bitrate
+static const unsigned s_maxFreeFormatBitrate = 640000;
+
+
+static const unsigned* getBitrates(MPEG::Version f_version, unsigned f_layer)
+{
+	return ((f_version == MPEG::Version::v1) ? s_bitratesV1 : s_bitratesV2)[f_layer - 1];
+}
+
+
+bool FrameHeader::parse(const unsigned char* f_data, FrameHeader& f_outHeader)
+{
+	if((f_data[0] != 0xFF) || ((f_data[1] & 0xE0) != 0xE0))
+		return false;
+
+	auto version = static_cast<MPEG::Version>((f_data[1] >> 3) & 0x03);
+	if(version == MPEG::Version::vReserved)
+		return false;
+
+	unsigned layer = 4 - ((f_data[1] >> 1) & 0x03);
+	if(layer == 4)
+		return false;
+
+	unsigned iBitrate = f_data[2] >> 4;
+	unsigned iSamplingRate = (f_data[2] >> 2) & 0x03;
+	if((iBitrate == 0x0F) || (iSamplingRate == 0x03))
+		return false;
+
+	FrameHeader& h = f_outHeader;
+	h.version		= version;
+	h.layer			= layer;
+	h.protection	= !(f_data[1] & 0x01);
+	h.bitrate		= getBitrates(version, layer)[iBitrate];
+	h.samplingRate	= s_samplingRates[iSamplingRate];
+	if(version != MPEG::Version::v1)
+		h.samplingRate >>= (version == MPEG::Version::v2) ? 1 : 2;
+	h.padding		= f_data[2] & 0x02;
+	h.channelMode	= static_cast<MPEG::ChannelMode>(f_data[3] >> 6);
+
+	if(layer == 1)
+		h.samples	= 384;
+	else
+		h.samples	= ((layer == 3) && (version != MPEG::Version::v1)) ? 576 : 1152;
+
+	// Slots of 4 bytes in Layer I
+	if(h.isFreeFormat())
+		h.size		= 0;
+	else if(layer == 1)
+		h.size		= (12 * h.bitrate * 1000 / h.samplingRate + (h.padding ? 1 : 0)) * 4;
+	else
+		h.size		= (h.samples / 8) * h.bitrate * 1000 / h.samplingRate + (h.padding ? 1 : 0);
+
+	return true;
+}
+
+
+bool FrameHeader::isCompatible(const FrameHeader& f_header) const
+{
+	return (version == f_header.version) && (layer == f_header.layer) && (samplingRate == f_header.samplingRate) &&
+		   (isFreeFormat() == f_header.isFreeFormat());
+}
+
+
+unsigned FrameHeader::sideInfoSize() const
+{
+	bool bMono = (channelMode == MPEG::ChannelMode::Mono);
+	if(version == MPEG::Version::v1)
+		return bMono ? 17 : 32;
+	return bMono ? 9 : 17;
+}
+
+// ====================================
+class BitReader
+{
+public:
+	explicit BitReader(const unsigned char* f_data):
+		m_data(f_data),
+		m_pos(0)
+	{}
+
+	unsigned read(unsigned f_bits)
+	{
+		unsigned value = 0;
+		for(; f_bits; --f_bits, ++m_pos)
+			value = (value << 1) | ((m_data[m_pos >> 3] >> (7 - (m_pos & 7))) & 1);
+		return value;
+	}
+
+	void skip(unsigned f_bits) { m_pos += f_bits; }
+
+private:
+	const unsigned char*	m_data;
+	size_t					m_pos;
+};
+
+
+bool SideInfo::parse(const unsigned char* f_frame, size_t f_size, const FrameHeader& f_header, SideInfo& f_outInfo)
+{
+	if((f_header.layer != 3) || (f_header.dataOffset() + f_header.sideInfoSize() > f_size))
+		return false;
+
+	bool bV1 = (f_header.version == MPEG::Version::v1);
+	SideInfo& info = f_outInfo;
+	info.granules = bV1 ? 2 : 1;
+	info.channels = (f_header.channelMode == MPEG::ChannelMode::Mono) ? 1 : 2;
+
+	BitReader bits(f_frame + f_header.dataOffset());
+	if(bV1)
+	{
+		info.mainDataBegin = bits.read(9);
+		bits.skip((info.channels == 1) ? 5 : 3);	// Private bits
+		bits.skip(4 * info.channels);				// scfsi
+	}
+	else
+	{
+		info.mainDataBegin = bits.read(8);
+		bits.skip(info.channels);					// Private bits
+	}
+
+	for(unsigned gr = 0; gr < info.granules; ++gr)
+	{
+		for(unsigned ch = 0; ch < info.channels; ++ch)
+		{
+			auto& granule = info.granule[gr][ch];
+			granule.part23Length	= bits.read(12);
+			granule.bigValues		= bits.read(9);
+			granule.globalGain		= bits.read(8);
+			// scalefac_compress, window_switching_flag and 22 bits of
+			// either branch, preflag (MPEG-1 only), scalefac_scale and
+			// count1table_select
+			bits.skip(bV1 ? (4 + 1 + 22 + 3) : (9 + 1 + 22 + 2));
+		}
+	}
+
+	return true;
+}
+
+
+unsigned SideInfo::mainDataSize() const
+{
+	unsigned bits = 0;
+	for(unsigned gr = 0; gr < granules; ++gr)
+	{
+		for(unsigned ch = 0; ch < channels; ++ch)
+			bits += granule[gr][ch].part23Length;
+	}
+	return (bits + 7) / 8;
+}
+
+
+bool SideInfo::isSilent(unsigned f_maxGain) const
+{
+	for(unsigned gr = 0; gr < granules; ++gr)
+	{
+		for(unsigned ch = 0; ch < channels; ++ch)
+		{
+			auto& g = granule[gr][ch];
+			if(g.part23Length && (g.bigValues || (g.globalGain > f_maxGain)))
+				return false;
+		}
+	}
+	return true;
+}
+
+// ====================================
+// Whether a frame of the f_header stream or the end of the data follows at
+// the f_pos
+static bool isNextFrame(const unsigned char* f_data, size_t f_size, size_t f_pos, const FrameHeader& f_header)
+{
+	FrameHeader next;
+	if(f_pos + FrameHeader::headerSize > f_size)
+		return f_pos == f_size;
+	return FrameHeader::parse(f_data + f_pos, next) && next.isCompatible(f_header);
+}
+
+
+// Size of a free format frame without the padding: the distance to the next
+// compatible header, which must be followed by one more. Return 0 if there
+// is none
+static unsigned findFreeFormatSize(const unsigned char* f_data, size_t f_size, const FrameHeader& f_header)
+{
+	unsigned slot = f_header.slotSize();
+	unsigned padding = f_header.padding ? slot : 0;
+	// A frame has samples / 8 * bitrate / sampling rate bytes: the factor is
+	// 144 for Layer II, 12 * 4 for Layer I and 72 for LSF Layer III
+	size_t maxSize = static_cast<size_t>(f_header.samples / 8) * s_maxFreeFormatBitrate / f_header.samplingRate + slot;
+	auto end = std::min(f_size, maxSize + padding + FrameHeader::headerSize);
+	for(size_t pos = f_header.dataOffset() + padding + 1; pos + FrameHeader::headerSize <= end; ++pos)
+	{
+		FrameHeader next;
+		if((f_data[pos] != 0xFF) || ((pos - padding) % slot) || !FrameHeader::parse(f_data + pos, next) ||
+		   !next.isCompatible(f_header))
+			continue;
+
+		auto size = pos - padding;
+		if(isNextFrame(f_data, f_size, pos + size + (next.padding ? slot : 0), f_header))
+			return size;
+	}
+	return 0;
+}
+
+
+FrameTable FrameTable::walk(const unsigned char* f_data, size_t f_size)
+{
+	FrameTable table;
+
+	FrameHeader prev;
+	bool bSync = false;
+	size_t gapOffset = 0;
+
+	// Free format frames have the same size but the padding. The size is
+	// found once a sync is established and then checked with the headers
+	unsigned freeFormatSize = 0;
+
+	size_t pos = 0;
+	while(pos + FrameHeader::headerSize <= f_size)
+	{
+		FrameHeader header;
+		bool bValid = FrameHeader::parse(f_data + pos, header) && (!bSync || header.isCompatible(prev));
+		if(bValid && header.isFreeFormat())
+		{
+			if(!bSync)
+				freeFormatSize = findFreeFormatSize(f_data + pos, f_size - pos, header);
+			header.size = freeFormatSize + (header.padding ? header.slotSize() : 0);
+			bValid = (freeFormatSize != 0);
+		}
+
+		// Without sync a header is accepted only if the next one follows it
+		if(bValid && !bSync)
+			bValid = isNextFrame(f_data, f_size, pos + header.size, header);
+
+		if(!bValid)
+		{
+			if(bSync)
+			{
+				bSync = false;
+				gapOffset = pos;
+			}
+			++pos;
+			continue;
+		}
+
+		if(pos + header.size > f_size)
+			break;
+
+		if(!bSync && (pos > gapOffset))
+			table.gaps.push_back({gapOffset, pos - gapOffset});
+
+		table.offsets.push_back(pos);
+		table.sizes.push_back(header.size);
+		prev = header;
+		bSync = true;
+		pos += header.size;
+	}
+
+	if(!bSync && (pos > gapOffset) && table.getFrameCount())
+	{
+		// The sync has been lost and never restored
+		table.tailOffset = gapOffset;
+		table.tailSize = f_size - gapOffset;
+	}
+	else
+	{
+		table.tailOffset = table.getFrameCount() ? (table.offsets.back() + table.sizes.back()) : 0;
+		table.tailSize = f_size - table.tailOffset;
+	}
+
+	return table;
+}
+
+int FrameTable::findFrame(size_t f_offset) const
+{
+	auto it = std::lower_bound(offsets.begin(), offsets.end(), f_offset);
+	if((it == offsets.end()) || (*it != f_offset))
+		return -1;
+	return it - offsets.begin();
+}
+
+
+unsigned FrameTable::getReservoirFrames(const unsigned char* f_data, unsigned f_index, unsigned f_first) const
+{
+	auto frame = f_data + offsets[f_index];
+	FrameHeader header;
+	SideInfo info;
+	if(!FrameHeader::parse(frame, header) || !SideInfo::parse(frame, sizes[f_index], header, info))
+		return 0;
+
+	unsigned n = 0;
+	size_t reservoir = 0;
+	for(auto i = f_index; (reservoir < info.mainDataBegin) && (i > f_first); --i, ++n)
+	{
+		FrameHeader prev;
+		if(!FrameHeader::parse(f_data + offsets[i - 1], prev))
+			break;
+		auto overhead = prev.dataOffset() + prev.sideInfoSize();
+		if(sizes[i - 1] > overhead)
+			reservoir += sizes[i - 1] - overhead;
+	}
+
+	return n;
+}
+
+// ====================================
+static size_t be32(const unsigned char* f_data)
+{
+	return (static_cast<size_t>(f_data[0]) << 24) | (f_data[1] << 16) | (f_data[2] << 8) | f_data[3];
+}
+
+
+static void putBE32(unsigned char* f_data, size_t f_value)
+{
+	f_data[0] = (f_value >> 24) & 0xFF;
+	f_data[1] = (f_value >> 16) & 0xFF;
+	f_data[2] = (f_value >> 8) & 0xFF;
+	f_data[3] = f_value & 0xFF;
+}
+
+
+bool XingHeader::parse(const unsigned char* f_frame, size_t f_size, XingHeader& f_outHeader)
+{
+	FrameHeader header;
+	if((f_size < FrameHeader::headerSize) || !FrameHeader::parse(f_frame, header) || (header.layer != 3))
+		return false;
+
+	size_t offset = header.dataOffset() + header.sideInfoSize();
+	if(offset + 8 > f_size)
+		return false;
+
+	auto p = f_frame + offset;
+	if(memcmp(p, "Xing", 4) && memcmp(p, "Info", 4))
+		return false;
+
+	XingHeader& xing = f_outHeader;
+	xing.offset	= offset;
+	xing.flags	= be32(p + 4);
+	xing.frames	= 0;
+	xing.bytes	= 0;
+
+	p += 8;
+	if(xing.flags & Flags::Frames)
+	{
+		if(p + 4 > f_frame + f_size)
+			return false;
+		xing.frames = be32(p);
+		p += 4;
+	}
+	if(xing.flags & Flags::Bytes)
+	{
+		if(p + 4 > f_frame + f_size)
+			return false;
+		xing.bytes = be32(p);
+		p += 4;
+	}
+	if(xing.flags & Flags::TOC)
+	{
+		if(p + sizeof(xing.toc) > f_frame + f_size)
+			return false;
+		memcpy(xing.toc, p, sizeof(xing.toc));
+	}
+	else
+		memset(xing.toc, 0, sizeof(xing.toc));
+
+	return true;
+}
+
+unsigned XingHeader::getSize() const
+{
+	return 8 + ((flags & Flags::Frames) ? 4 : 0) + ((flags & Flags::Bytes) ? 4 : 0) +
+		   ((flags & Flags::TOC) ? 100 : 0) + ((flags & Flags::Quality) ? 4 : 0);
+}
+
+
+void XingHeader::buildTOC(const FrameTable& f_music, size_t f_frameSize)
+{
+	unsigned nFrames = f_music.getFrameCount();
+	for(unsigned i = 0; i < sizeof(toc); ++i)
+	{
+		// The frame at the i percent of the audio frames
+		uint64_t position = f_frameSize + (nFrames ? f_music.offsets[i * nFrames / 100] : 0);
+		toc[i] = bytes ? std::min<uint64_t>(position * 256 / bytes, 255) : 0;
+	}
+}
+
+
+void XingHeader::write(unsigned char* f_frame) const
+{
+	auto p = f_frame + offset + 8;
+	if(flags & Flags::Frames)
+	{
+		putBE32(p, frames);
+		p += 4;
+	}
+	if(flags & Flags::Bytes)
+	{
+		putBE32(p, bytes);
+		p += 4;
+	}
+	if(flags & Flags::TOC)
+		memcpy(p, toc, sizeof(toc));
+}
+
+// ====================================
+static unsigned short crc16(unsigned short f_crc, const unsigned char* f_data, size_t f_size)
+{
+	for(size_t i = 0; i < f_size; ++i)
+	{
+		f_crc ^= f_data[i] << 8;
+		for(unsigned bit = 0; bit < 8; ++bit)
+			f_crc = (f_crc & 0x8000) ? ((f_crc << 1) ^ 0x8005) : (f_crc << 1);
+	}
+	return f_crc;
+}
+
+
+unsigned short calcFrameCRC(const unsigned char* f_frame, const FrameHeader& f_header)
+{
+	// The last two header bytes and the side information
+	auto crc = crc16(0xFFFF, f_frame + 2, 2);
+	return crc16(crc, f_frame + f_header.dataOffset(), f_header.sideInfoSize());
+}
+
+
+void silenceFrame(unsigned char* f_frame, size_t f_size)
+{
+	FrameHeader header;
+	if(!FrameHeader::parse(f_frame, header) || (header.layer != 3) || (header.dataOffset() + header.sideInfoSize() > f_size))
+		return;
+
+	// Zero main_data_begin and part2_3_length of every granule: nothing is
+	// decoded from the main data. Zero scale factor and block fields too
+	memset(f_frame + header.dataOffset(), 0, header.sideInfoSize());
+
+	if(header.protection)
+	{
+		auto crc = calcFrameCRC(f_frame, header);
+		f_frame[4] = crc >> 8;
+		f_frame[5] = crc & 0xFF;
+	}
+}
+
+// ====================================
+// CRC-16 of the LAME tag: reflected polynomial 0x8005 with a zero initial value
+static unsigned short crc16Lame(unsigned short f_crc, const unsigned char* f_data, size_t f_size)
+{
+	for(size_t i = 0; i < f_size; ++i)
+	{
+		f_crc ^= f_data[i];
+		for(unsigned bit = 0; bit < 8; ++bit)
+			f_crc = (f_crc & 1) ? ((f_crc >> 1) ^ 0xA001) : (f_crc >> 1);
+	}
+	return f_crc;
+}
+
+
+// Offsets of the LAME tag fields
+enum LameField
+{
+	Version		= 0,
+	Revision	= 9,
+	Gapless		= 21,	// 12-bit delay and 12-bit padding
+	MusicLength	= 28,
+	MusicCRC	= 32,
+	TagCRC		= 34
+};
+
+static const char s_lameVersion[] = "LAME3.100";
+
+
+bool LameTag::parse(const unsigned char* f_frame, size_t f_size, const XingHeader& f_xing, LameTag& f_outTag)
+{
+	size_t offset = f_xing.offset + f_xing.getSize();
+	if(offset + size > f_size)
+		return false;
+
+	// Encoders which write the tag put their name in the version
+	auto p = f_frame + offset;
+	bool bKnown = !memcmp(p, "LAME", 4) || !memcmp(p, "Lavf", 4) || !memcmp(p, "Lavc", 4);
+	auto crc = (p[LameField::TagCRC] << 8) | p[LameField::TagCRC + 1];
+	if(!bKnown && (crc16Lame(0, f_frame, offset + LameField::TagCRC) != crc))
+		return false;
+
+	LameTag& tag = f_outTag;
+	tag.offset		= offset;
+	tag.delay		= (p[LameField::Gapless] << 4) | (p[LameField::Gapless + 1] >> 4);
+	tag.padding		= ((p[LameField::Gapless + 1] & 0x0F) << 8) | p[LameField::Gapless + 2];
+	tag.musicLength	= be32(p + LameField::MusicLength);
+
+	return true;
+}
+
+
+bool LameTag::create(unsigned char* f_frame, size_t f_size, const XingHeader& f_xing, LameTag& f_outTag)
+{
+	size_t offset = f_xing.offset + f_xing.getSize();
+	if(offset + size > f_size)
+		return false;
+
+	// Another encoder may have put its data there
+	auto p = f_frame + offset;
+	if(std::any_of(p, p + size, [](unsigned char f_byte) { return f_byte != 0; }))
+		return false;
+	memcpy(p + LameField::Version, s_lameVersion, LameField::Revision);
+
+	f_outTag = {offset, 0, 0, 0};
+	return true;
+}
+
+
+void LameTag::write(unsigned char* f_frame, const unsigned char* f_music, size_t f_musicSize) const
+{
+	ASSERT((delay <= maxDelay) && (padding <= maxDelay));
+
+	auto p = f_frame + offset;
+	p[LameField::Gapless]		= delay >> 4;
+	p[LameField::Gapless + 1]	= ((delay & 0x0F) << 4) | (padding >> 8);
+	p[LameField::Gapless + 2]	= padding & 0xFF;
+	putBE32(p + LameField::MusicLength, musicLength);
+
+	auto crc = crc16Lame(0, f_music, f_musicSize);
+	p[LameField::MusicCRC]		= crc >> 8;
+	p[LameField::MusicCRC + 1]	= crc & 0xFF;
+
+	crc = crc16Lame(0, f_frame, offset + LameField::TagCRC);
+	p[LameField::TagCRC]		= crc >> 8;
+	p[LameField::TagCRC + 1]	= crc & 0xFF;
+}
+
+
+std::vector<unsigned char> makeXingFrame(const unsigned char* f_header, bool f_vbr)
+{
+	FrameHeader header;
+	if(!FrameHeader::parse(f_header, header) || (header.layer != 3) || header.isFreeFormat())
+		return {};
+
+	// No CRC, no padding and no mode extension
+	unsigned char bytes[FrameHeader::headerSize] = {f_header[0],
+													static_cast<unsigned char>(f_header[1] | 0x01),
+													static_cast<unsigned char>(f_header[2] & 0x0C),
+													static_cast<unsigned char>(f_header[3] & 0xCF)};
+	header.protection = false;
+	header.padding = false;
+
+	XingHeader xing = {header.dataOffset() + header.sideInfoSize(), XingHeader::Flags::Frames | XingHeader::Flags::Bytes, 0, 0, {}};
+	auto needed = xing.offset + xing.getSize() + LameTag::size;
+
+	auto bitrates = getBitrates(header.version, header.layer);
+	unsigned iBitrate = 1;
+	for(; iBitrate < 15; ++iBitrate)
+	{
+		if((header.samples / 8) * bitrates[iBitrate] * 1000 / header.samplingRate >= needed)
+			break;
+	}
+	if(iBitrate == 15)
+		return {};
+	bytes[2] |= iBitrate << 4;
+	FrameHeader::parse(bytes, header);
+
+	// Zero side information is a frame of silence
+	std::vector<unsigned char> frame(header.size, 0);
+	memcpy(frame.data(), bytes, sizeof(bytes));
+	memcpy(frame.data() + xing.offset, f_vbr ? "Xing" : "Info", 4);
+	putBE32(frame.data() + xing.offset + 4, xing.flags);
+
+	LameTag tag;
+	LameTag::create(frame.data(), frame.size(), xing, tag);
+	return frame;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+
+#include <vector>
+
+#include "External/inc/mpeg.h"
+
+
+// MPEG audio frame header
+struct FrameHeader
+{
+	MPEG::Version		version;
+	unsigned			layer;
+	bool				protection;		// CRC-16 follows the header
+	unsigned			bitrate;		// kbps, 0 in the free format
+	unsigned			samplingRate;	// Hz
+	bool				padding;
+	MPEG::ChannelMode	channelMode;
+
+	unsigned			size;			// Whole frame size in bytes, 0 in the free format
+	unsigned			samples;		// Samples per frame
+
+	static const unsigned	headerSize	= 4;
+	static const unsigned	crcSize		= 2;
+
+	// Return false if the 4 bytes are not a valid frame header of any layer
+	static bool		parse			(const unsigned char* f_data, FrameHeader& f_outHeader);
+
+	// Frames of the same stream share these fields
+	bool			isCompatible	(const FrameHeader& f_header) const;
+
+	// The frame size isn't given by the bitrate, it's the distance between
+	// the headers of the stream
+	bool			isFreeFormat	() const { return !bitrate; }
+	// Padding unit in bytes
+	unsigned		slotSize		() const { return (layer == 1) ? 4 : 1; }
+
+	// Layer III side information size
+	unsigned		sideInfoSize	() const;
+	// Offset of the side information (Layer III) or audio data
+	unsigned		dataOffset		() const { return headerSize + (protection ? crcSize : 0); }
+};
+
+
+// Layer III side information fields which are available without decoding
+struct SideInfo
+{
+	struct Granule
+	{
+		unsigned	part23Length;	// Bits of scale factors and Huffman data
+		unsigned	bigValues;		// Pairs of quantized values above 1
+		unsigned	globalGain;
+	};
+
+	unsigned	mainDataBegin;		// Bytes borrowed from the preceding frames (bit reservoir)
+	unsigned	granules;
+	unsigned	channels;
+	Granule		granule[2][2];		// [granule][channel]
+
+	// Return false if the frame is not Layer III or too short
+	static bool	parse			(const unsigned char* f_frame, size_t f_size, const FrameHeader& f_header, SideInfo& f_outInfo);
+
+	// Size of the main data of this frame in bytes
+	unsigned	mainDataSize	() const;
+
+	// Every granule is either empty or has only +-1 values at a gain not
+	// above the f_maxGain, i.e. the frame encodes digital silence
+	bool		isSilent		(unsigned f_maxGain) const;
+};
+
+
+// Offsets and sizes of the MPEG frames of a data region found by walking the
+// frame headers. Free format frames are supported
+struct FrameTable
+{
+	// Junk between frames, i.e. the sync has been lost at the offset
+	struct Gap
+	{
+		size_t	offset;
+		size_t	size;
+	};
+
+	std::vector<size_t>		offsets;
+	std::vector<unsigned>	sizes;
+	std::vector<Gap>		gaps;
+
+	// Junk or an incomplete frame after the last complete frame
+	size_t					tailOffset	= 0;
+	size_t					tailSize	= 0;
+
+	unsigned	getFrameCount	() const { return offsets.size(); }
+	// Return the index of the frame at the offset or -1
+	int			findFrame		(size_t f_offset) const;
+
+	// Number of frames preceding the f_index whose main data areas hold the
+	// bit reservoir bytes the frame refers to. Frames before the f_first are
+	// not counted
+	unsigned	getReservoirFrames	(const unsigned char* f_data, unsigned f_index, unsigned f_first) const;
+
+	static FrameTable	walk	(const unsigned char* f_data, size_t f_size);
+};
+
+
+// Xing/Info VBR header of the first frame
+struct XingHeader
+{
+	enum Flags
+	{
+		Frames	= 1 << 0,
+		Bytes	= 1 << 1,
+		TOC		= 1 << 2,
+		Quality	= 1 << 3
+	};
+
+	size_t		offset;		// Offset of the "Xing"/"Info" ID relative to the frame
+	unsigned	flags;
+	unsigned	frames;		// Audio frames, i.e. without the Xing frame
+	unsigned	bytes;		// Including the Xing frame
+	// Byte positions of each percent of the duration in 1/256 of the bytes
+	unsigned char	toc[100];
+
+	// Size of the header including the optional fields
+	unsigned	getSize		() const;
+
+	// Return false if the frame has no Xing/Info header. Only Layer III
+	// frames have one
+	static bool	parse		(const unsigned char* f_frame, size_t f_size, XingHeader& f_outHeader);
+
+	// Rebuild the TOC from the frames of the f_music which follows the Xing
+	// frame of the f_frameSize. The bytes must be set before
+	void		buildTOC	(const FrameTable& f_music, size_t f_frameSize);
+
+	// Update the frames, bytes and TOC fields which are present
+	void		write		(unsigned char* f_frame) const;
+};
+
+
+// LAME tag which follows the Xing/Info header. Gapless players trim the
+// encoder delay and padding samples off the decoded stream
+struct LameTag
+{
+	static const unsigned	size		= 36;
+	static const unsigned	maxDelay	= 0xFFF;	// 12-bit fields
+
+	size_t		offset;			// Relative to the frame
+	unsigned	delay;			// Samples to skip at the beginning
+	unsigned	padding;		// Samples to skip at the end
+	unsigned	musicLength;	// Bytes including the Xing frame
+
+	// Return false if the Xing header isn't followed by a LAME tag
+	static bool	parse	(const unsigned char* f_frame, size_t f_size, const XingHeader& f_xing, LameTag& f_outTag);
+	// Initialize an empty LAME tag after the Xing header. Return false if
+	// the frame is too short or the bytes are used, i.e. not all zero
+	static bool	create	(unsigned char* f_frame, size_t f_size, const XingHeader& f_xing, LameTag& f_outTag);
+
+	// Update the fields and CRCs. The f_music is the audio after the Xing frame
+	void		write	(unsigned char* f_frame, const unsigned char* f_music, size_t f_musicSize) const;
+};
+
+// Silent frame with an empty Xing/Info header and LAME tag. It has the
+// version, sampling rate and channel mode of the f_header frame and the
+// lowest bitrate which fits the headers. Return an empty frame if the
+// f_header is not a Layer III one with a bitrate
+std::vector<unsigned char>	makeXingFrame	(const unsigned char* f_header, bool f_vbr);
+
+
+// CRC-16 (polynomial 0x8005) of a Layer III frame as stored after the header
+unsigned short	calcFrameCRC	(const unsigned char* f_frame, const FrameHeader& f_header);
+
+// Turn a Layer III frame into silence which doesn't refer to the bit
+// reservoir. The main data bytes are kept for the following frames
+void			silenceFrame	(unsigned char* f_frame, size_t f_size);
@@ -0,0 +1,337 @@
+// libFuzzer targets of the parsers and the cut engine, built with "make fuzz".
+// The first input byte selects the target, the rest is the file data. Besides
+// crashes and sanitizer reports every target checks invariants and compares
+// the fast paths against the straightforward sequential ones
+#include "External/inc/mp3.h"
+#include "External/inc/mpeg.h"
+#include "External/inc/tag.h"
+
+#include "layout.h"
+#include "id3v2.h"
+#include "frames.h"
+#include "hash.h"
+#include "buffer.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+#define CHECK(X)	do { if(!(X)) { fprintf(stderr, "CHECK failed: %s @ %s:%d\n", #X, __FILE__, __LINE__); abort(); } } while(0)
+
+
+// Input which is consumed piece by piece
+class Input
+{
+public:
+	Input(const unsigned char* f_data, size_t f_size):
+		m_data(f_data),
+		m_size(f_size)
+	{}
+
+	unsigned byte()
+	{
+		if(!m_size)
+			return 0;
+		--m_size;
+		return *m_data++;
+	}
+
+	unsigned word() { return (byte() << 8) | byte(); }
+
+	const unsigned char*	data() const { return m_data; }
+	size_t					size() const { return m_size; }
+
+private:
+	const unsigned char*	m_data;
+	size_t					m_size;
+};
+
+// ====================================
+// Library entry points. Rejecting an input with an exception is fine
+static void fuzzLibrary(Input& f_in)
+{
+	auto data = f_in.data();
+	auto size = f_in.size();
+	try
+	{
+		if(auto mp3 = IMP3::create(data, size))
+		{
+			if(auto stream = mp3->mpegStream())
+			{
+				CHECK(mp3->mpegStreamOffset() + stream->getSize() <= size);
+				for(unsigned i = 0, n = stream->getFrameCount(); i < n; ++i)
+					CHECK(stream->getFrameOffset(i) + stream->getFrameSize(i) <= stream->getSize());
+			}
+		}
+	}
+	catch(const std::exception&) {}
+
+	try { MPEG::IStream::create(data, size); } catch(const std::exception&) {}
+	try { Tag::IID3v1::create(data, 0, size); } catch(const std::exception&) {}
+	try { Tag::IID3v2::create(data, 0, size); } catch(const std::exception&) {}
+	try { Tag::IAPE::create(data, 0, size); } catch(const std::exception&) {}
+	try { Tag::ILyrics::create(data, 0, size); } catch(const std::exception&) {}
+}
+
+// ====================================
+// The piecewise probe of the batch loader must agree with the whole file probe
+static void fuzzLayout(Input& f_in)
+{
+	auto headSize = f_in.word();
+	auto tailSize = f_in.word();
+	auto data = f_in.data();
+	auto size = f_in.size();
+
+	auto layout = Layout::probe(data, size);
+	CHECK(layout.fileSize == size);
+	CHECK(layout.id3v2Offset + layout.id3v2Size <= layout.mpegOffset);
+	CHECK(layout.mpegOffset + layout.mpegSize <= size);
+	CHECK(layout.trailerOffset() + layout.trailerSize() == size);
+
+	// The head covers the ID3v2 header at least, as the batch loader's does
+	Layout pieces;
+	pieces.fileSize = size;
+	headSize = std::min<size_t>(std::max<size_t>(headSize, 10), size);
+	pieces.probeHead(data, headSize);
+	for(size_t needed = std::min<size_t>(tailSize, size);;)
+	{
+		size_t retry;
+		if(pieces.probeTrailer(data + size - needed, needed, retry))
+			break;
+		CHECK((retry > needed) && (retry <= size));
+		needed = retry;
+	}
+
+	CHECK((pieces.id3v2Overrun == layout.id3v2Overrun) && (pieces.trailerIssues == layout.trailerIssues));
+	CHECK(pieces.id3v2Size == layout.id3v2Size);
+	CHECK(pieces.mpegOffset == layout.mpegOffset);
+	CHECK(pieces.mpegSize == layout.mpegSize);
+	CHECK(pieces.apeSize == layout.apeSize);
+	CHECK(pieces.lyricsSize == layout.lyricsSize);
+	CHECK(pieces.id3v1Size == layout.id3v1Size);
+	CHECK(pieces.trailerSize() == layout.trailerSize());
+}
+
+// ====================================
+// Lazy access, editing and serialization of the ID3v2 tag
+static void fuzzID3v2(Input& f_in)
+{
+	static const char* s_ids[] = {"TIT2", "TPE1", "COMM", "TXXX", "WXXX", "TT2", "TCON", "USLT"};
+	auto edit = f_in.byte();
+	auto data = f_in.data();
+	auto size = f_in.size();
+
+	auto tag = LazyID3v2::create(data, size);
+	if(!tag)
+		return;
+	CHECK(tag->getSize() <= size);
+
+	for(auto id : s_ids)
+	{
+		for(unsigned i = 0, n = tag->getTextCount(id); i < n; ++i)
+			tag->getText(id, i);
+	}
+	for(unsigned i = 0, n = tag->getPictureCount(); i < n; ++i)
+	{
+		// The view may point to the input or an unsynchronised copy. Touch
+		// its ends for the address sanitizer
+		auto picture = tag->getPictureData(i);
+		if(picture.size)
+		{
+			volatile unsigned char c = picture.data[0];
+			c = picture.data[picture.size - 1];
+			(void)c;
+		}
+	}
+
+	// An unmodified tag is copied as is
+	std::vector<unsigned char> out;
+	tag->serialize(out);
+	CHECK((out.size() == tag->getSize()) && !memcmp(out.data(), data, out.size()));
+
+	if(edit & 1)
+	{
+		try
+		{
+			auto id = s_ids[(edit >> 1) % (sizeof(s_ids) / sizeof(s_ids[0]))];
+			std::string text(reinterpret_cast<const char*>(data), std::min<size_t>(size, edit >> 4));
+			tag->setText(id, text);
+		}
+		catch(const std::exception&)
+		{
+			return;
+		}
+	}
+
+	// The serialized tag parses cleanly with the same frames
+	auto padded = tag->getRequiredSize() + (edit >> 4);
+	out.clear();
+	tag->serialize(out, padded);
+	CHECK(out.size() == padded);
+	CHECK(LazyID3v2::getSize(out.data(), out.size()) == padded);
+
+	auto copy = LazyID3v2::create(out.data(), out.size());
+	CHECK(copy && !copy->hasIssues());
+	CHECK(copy->getPaddingSize() == padded - tag->getRequiredSize());
+	CHECK(copy->frames().size() == tag->frames().size());
+	for(size_t i = 0; i < tag->frames().size(); ++i)
+	{
+		CHECK(copy->frames()[i].id == tag->frames()[i].id);
+		CHECK(copy->frames()[i].size == tag->frames()[i].size);
+	}
+}
+
+// ====================================
+// The frame walker, side information and the parallel helpers
+static void fuzzFrames(Input& f_in)
+{
+	auto nThreads = 1 + f_in.byte() % 8;
+	auto step = 1 + f_in.byte();
+	auto data = f_in.data();
+	auto size = f_in.size();
+
+	auto table = FrameTable::walk(data, size);
+	size_t end = 0;
+	for(unsigned i = 0; i < table.getFrameCount(); ++i)
+	{
+		CHECK(table.offsets[i] >= end);
+		end = table.offsets[i] + table.sizes[i];
+		CHECK(end <= size);
+		CHECK(table.findFrame(table.offsets[i]) == static_cast<int>(i));
+
+		FrameHeader header;
+		CHECK(FrameHeader::parse(data + table.offsets[i], header));
+		SideInfo info;
+		if(SideInfo::parse(data + table.offsets[i], table.sizes[i], header, info))
+			CHECK(info.granules && info.channels);
+		CHECK(table.getReservoirFrames(data, i, 0) <= i);
+
+		// A silenced frame is a valid frame without the bit reservoir
+		std::vector<unsigned char> frame(data + table.offsets[i], data + end);
+		silenceFrame(frame.data(), frame.size());
+		FrameHeader silent;
+		CHECK(FrameHeader::parse(frame.data(), silent));
+		if(SideInfo::parse(frame.data(), frame.size(), silent, info))
+			CHECK(!info.mainDataBegin && !info.mainDataSize());
+		if(silent.protection && (silent.layer == 3))
+		{
+			auto crc = calcFrameCRC(frame.data(), silent);
+			CHECK((frame[4] == (crc >> 8)) && (frame[5] == (crc & 0xFF)));
+		}
+	}
+	CHECK(table.tailOffset + table.tailSize <= size);
+
+	// The LAME tag written to a frame is read back
+	XingHeader xing;
+	if(table.getFrameCount() && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing))
+	{
+		std::vector<unsigned char> frame(data + table.offsets[0], data + table.offsets[0] + table.sizes[0]);
+		LameTag tag;
+		if(LameTag::parse(frame.data(), frame.size(), xing, tag) || LameTag::create(frame.data(), frame.size(), xing, tag))
+		{
+			tag.delay = step * 7;
+			tag.padding = step * 13;
+			tag.write(frame.data(), data, size);
+			LameTag copy;
+			CHECK(LameTag::parse(frame.data(), frame.size(), xing, copy));
+			CHECK((copy.delay == tag.delay) && (copy.padding == tag.padding));
+		}
+	}
+
+	// Streaming and parallel computations match the sequential ones
+	Hash64 hash;
+	for(size_t i = 0; i < size; i += step)
+		hash.update(data + i, std::min<size_t>(step, size - i));
+	CHECK(hash.digest() == Hash64::calc(data, size));
+
+	std::atomic<size_t> sum(0);
+	parallelFor(size, [&](size_t i) { sum += data[i]; }, nThreads);
+	size_t expected = 0;
+	for(size_t i = 0; i < size; ++i)
+		expected += data[i];
+	CHECK(sum == expected);
+
+	auto buffer = BufferPool::instance().acquire(size);
+	CHECK(buffer.empty() && (buffer.capacity() >= size));
+	BufferPool::instance().release(std::move(buffer));
+}
+
+// ====================================
+// Cut and serialize round trip of the library stream
+static void fuzzCut(Input& f_in)
+{
+	auto frame = f_in.word();
+	auto count = f_in.word();
+	bool bTruncate = f_in.byte() & 1;
+	auto data = f_in.data();
+	auto size = f_in.size();
+
+	std::shared_ptr<MPEG::IStream> stream;
+	try
+	{
+		stream = MPEG::IStream::create(data, size);
+	}
+	catch(const std::exception&)
+	{
+		return;
+	}
+	if(!stream)
+		return;
+
+	bool bIssues = stream->hasIssues();
+	auto nFrames = stream->getFrameCount();
+	if(!nFrames)
+		return;
+	frame %= nFrames;
+
+	unsigned nCut;
+	try
+	{
+		nCut = bTruncate ? stream->truncate(count) : stream->cut(frame, count);
+	}
+	catch(const std::out_of_range&)
+	{
+		return;
+	}
+	CHECK(nCut <= count);
+	CHECK(nCut <= (bTruncate ? nFrames : nFrames - frame));
+	CHECK(stream->getFrameCount() == nFrames - nCut);
+
+	std::vector<unsigned char> out;
+	stream->serialize(out);
+	size_t expected = 0;
+	for(unsigned i = 0, n = stream->getFrameCount(); i < n; ++i)
+		expected += stream->getFrameSize(i);
+	CHECK(out.size() >= expected);
+
+	// The output re-parses cleanly and the walker agrees with the library
+	if(bIssues || out.empty())
+		return;
+	auto copy = MPEG::IStream::create(out.data(), out.size());
+	CHECK(copy && !copy->hasIssues());
+	CHECK(copy->getFrameCount() == nFrames - nCut);
+
+	auto table = FrameTable::walk(out.data(), out.size());
+	if(table.gaps.empty() && !table.tailSize && (table.getFrameCount() == copy->getFrameCount()))
+	{
+		for(unsigned i = 0; i < table.getFrameCount(); ++i)
+			CHECK(table.offsets[i] == copy->getFrameOffset(i));
+	}
+}
+
+// ====================================
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* f_data, size_t f_size)
+{
+	using target_t = void (*)(Input&);
+	static const target_t s_targets[] = {fuzzLibrary, fuzzLayout, fuzzID3v2, fuzzFrames, fuzzCut};
+
+	Input in(f_data, f_size);
+	auto target = in.byte() % (sizeof(s_targets) / sizeof(s_targets[0]));
+	s_targets[target](in);
+
+	return 0;
+}
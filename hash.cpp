@@ -0,0 +1,133 @@
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+static const uint64_t s_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t s_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t s_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t s_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t s_prime5 = 0x27D4EB2F165667C5ULL;
+
+
+static inline uint64_t rotl(uint64_t f_x, unsigned f_bits)
+{
+	return (f_x << f_bits) | (f_x >> (64 - f_bits));
+}
+
+// Little endian loads regardless of the alignment
+static inline uint64_t le64(const unsigned char* f_data)
+{
+	uint64_t x = 0;
+	for(unsigned i = 0; i < 8; ++i)
+		x |= static_cast<uint64_t>(f_data[i]) << (8 * i);
+	return x;
+}
+
+static inline uint64_t le32(const unsigned char* f_data)
+{
+	return f_data[0] | (f_data[1] << 8) | (f_data[2] << 16) | (static_cast<uint64_t>(f_data[3]) << 24);
+}
+
+
+static inline uint64_t mix(uint64_t f_acc, uint64_t f_input)
+{
+	return rotl(f_acc + f_input * s_prime2, 31) * s_prime1;
+}
+
+static inline uint64_t merge(uint64_t f_acc, uint64_t f_value)
+{
+	return (f_acc ^ mix(0, f_value)) * s_prime1 + s_prime4;
+}
+
+
+// Consume whole 32-byte stripes. Return the number of bytes consumed
+static size_t consume(uint64_t (&f_ioAcc)[4], const unsigned char* f_data, size_t f_size)
+{
+	// The four lanes are independent, so they are computed in parallel by the CPU
+	auto v0 = f_ioAcc[0], v1 = f_ioAcc[1], v2 = f_ioAcc[2], v3 = f_ioAcc[3];
+	size_t i = 0;
+	for(; i + 32 <= f_size; i += 32)
+	{
+		v0 = mix(v0, le64(f_data + i));
+		v1 = mix(v1, le64(f_data + i + 8));
+		v2 = mix(v2, le64(f_data + i + 16));
+		v3 = mix(v3, le64(f_data + i + 24));
+	}
+	f_ioAcc[0] = v0; f_ioAcc[1] = v1; f_ioAcc[2] = v2; f_ioAcc[3] = v3;
+	return i;
+}
+
+
+Hash64::Hash64(uint64_t f_seed):
+	m_seed(f_seed),
+	m_acc{f_seed + s_prime1 + s_prime2, f_seed + s_prime2, f_seed, f_seed - s_prime1},
+	m_total(0),
+	m_buffered(0)
+{}
+
+
+void Hash64::update(const unsigned char* f_data, size_t f_size)
+{
+	m_total += f_size;
+
+	if(m_buffered)
+	{
+		auto n = std::min(sizeof(m_buffer) - m_buffered, f_size);
+		memcpy(m_buffer + m_buffered, f_data, n);
+		m_buffered += n;
+		f_data += n;
+		f_size -= n;
+		if(m_buffered < sizeof(m_buffer))
+			return;
+		consume(m_acc, m_buffer, sizeof(m_buffer));
+		m_buffered = 0;
+	}
+
+	auto n = consume(m_acc, f_data, f_size);
+	m_buffered = f_size - n;
+	memcpy(m_buffer, f_data + n, m_buffered);
+}
+
+
+uint64_t Hash64::digest() const
+{
+	uint64_t h;
+	if(m_total >= sizeof(m_buffer))
+	{
+		h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+		for(auto acc : m_acc)
+			h = merge(h, acc);
+	}
+	else
+		h = m_seed + s_prime5;
+	h += m_total;
+
+	auto p = m_buffer;
+	auto end = m_buffer + m_buffered;
+	for(; p + 8 <= end; p += 8)
+		h = rotl(h ^ mix(0, le64(p)), 27) * s_prime1 + s_prime4;
+	if(p + 4 <= end)
+	{
+		h = rotl(h ^ (le32(p) * s_prime1), 23) * s_prime2 + s_prime3;
+		p += 4;
+	}
+	for(; p < end; ++p)
+		h = rotl(h ^ (*p * s_prime5), 11) * s_prime1;
+
+	h ^= h >> 33;
+	h *= s_prime2;
+	h ^= h >> 29;
+	h *= s_prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+uint64_t Hash64::calc(const unsigned char* f_data, size_t f_size, uint64_t f_seed)
+{
+	Hash64 hash(f_seed);
+	hash.update(f_data, f_size);
+	return hash.digest();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+
+// XXH64: the 64-bit xxHash, a fast non-cryptographic hash. The data may be
+// fed in pieces, the result is the same as for the data in one piece
+class Hash64 final
+{
+public:
+	explicit Hash64(uint64_t f_seed = 0);
+
+	void		update	(const unsigned char* f_data, size_t f_size);
+	uint64_t	digest	() const;
+
+	static uint64_t	calc	(const unsigned char* f_data, size_t f_size, uint64_t f_seed = 0);
+
+private:
+	uint64_t		m_seed;
+	uint64_t		m_acc[4];
+	uint64_t		m_total;
+
+	unsigned char	m_buffer[32];	// Input which doesn't fill a stripe
+	size_t			m_buffered;
+};
@@ -0,0 +1,680 @@
+#include "id3v2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+static const size_t s_headerSize = 10;
+static const size_t s_maxSyncsafe = 0x0FFFFFFF;
+static const size_t s_footerSize = 10;
+
+enum Flags
+{
+	Unsynchronisation	= 0x80,
+	ExtendedHeader		= 0x40,
+	Footer				= 0x10
+};
+
+
+static size_t syncsafe32(const unsigned char* f_data)
+{
+	return (f_data[0] << 21) | (f_data[1] << 14) | (f_data[2] << 7) | f_data[3];
+}
+
+static size_t be32(const unsigned char* f_data)
+{
+	return (static_cast<size_t>(f_data[0]) << 24) | (f_data[1] << 16) | (f_data[2] << 8) | f_data[3];
+}
+
+static size_t be24(const unsigned char* f_data)
+{
+	return (f_data[0] << 16) | (f_data[1] << 8) | f_data[2];
+}
+
+
+// Replace every 0xFF 0x00 with 0xFF
+static void deunsynchronise(const unsigned char* f_data, size_t f_size, std::vector<unsigned char>& f_out)
+{
+	f_out.reserve(f_out.size() + f_size);
+	for(size_t i = 0; i < f_size; ++i)
+	{
+		f_out.push_back(f_data[i]);
+		if((f_data[i] == 0xFF) && (i + 1 < f_size) && !f_data[i + 1])
+			++i;
+	}
+}
+
+// ====================================
+static void appendUTF8(std::string& f_str, unsigned f_cp)
+{
+	if(f_cp < 0x80)
+		f_str += static_cast<char>(f_cp);
+	else if(f_cp < 0x800)
+	{
+		f_str += static_cast<char>(0xC0 | (f_cp >> 6));
+		f_str += static_cast<char>(0x80 | (f_cp & 0x3F));
+	}
+	else if(f_cp < 0x10000)
+	{
+		f_str += static_cast<char>(0xE0 | (f_cp >> 12));
+		f_str += static_cast<char>(0x80 | ((f_cp >> 6) & 0x3F));
+		f_str += static_cast<char>(0x80 | (f_cp & 0x3F));
+	}
+	else
+	{
+		f_str += static_cast<char>(0xF0 | (f_cp >> 18));
+		f_str += static_cast<char>(0x80 | ((f_cp >> 12) & 0x3F));
+		f_str += static_cast<char>(0x80 | ((f_cp >> 6) & 0x3F));
+		f_str += static_cast<char>(0x80 | (f_cp & 0x3F));
+	}
+}
+
+
+enum Encoding
+{
+	Latin1	= 0,
+	UTF16	= 1, // With BOM
+	UTF16BE	= 2,
+	UTF8	= 3
+};
+
+// Decode a string up to the terminator (f_single) or up to the end, convert
+// it to UTF-8 and advance the f_ioData past the terminator. Inner
+// terminators of multi-value ID3v2.4 frames are replaced with '/'
+static std::string decodeString(unsigned f_encoding, const unsigned char*& f_ioData, const unsigned char* f_end, bool f_single)
+{
+	std::string str;
+	auto p = f_ioData;
+
+	if((f_encoding == Encoding::UTF16) || (f_encoding == Encoding::UTF16BE))
+	{
+		bool bBigEndian = (f_encoding == Encoding::UTF16BE);
+		unsigned surrogate = 0;
+
+		for(; p + 1 < f_end; p += 2)
+		{
+			unsigned unit = bBigEndian ? ((p[0] << 8) | p[1]) : ((p[1] << 8) | p[0]);
+			if(unit == 0xFEFF)
+			{
+				continue;
+			}
+			else if(unit == 0xFFFE)
+			{
+				bBigEndian = !bBigEndian;
+				continue;
+			}
+			else if(!unit)
+			{
+				if(f_single)
+				{
+					p += 2;
+					break;
+				}
+				if((p + 2 < f_end) && !str.empty())
+					str += '/';
+				continue;
+			}
+
+			if((unit >= 0xD800) && (unit < 0xDC00))
+				surrogate = unit;
+			else if((unit >= 0xDC00) && (unit < 0xE000))
+			{
+				if(surrogate)
+					appendUTF8(str, 0x10000 + ((surrogate - 0xD800) << 10) + (unit - 0xDC00));
+				surrogate = 0;
+			}
+			else
+				appendUTF8(str, unit);
+		}
+	}
+	else
+	{
+		for(; p < f_end; ++p)
+		{
+			if(!*p)
+			{
+				if(f_single)
+				{
+					++p;
+					break;
+				}
+				if((p + 1 < f_end) && !str.empty())
+					str += '/';
+				continue;
+			}
+
+			if(f_encoding == Encoding::Latin1)
+				appendUTF8(str, *p);
+			else
+				str += static_cast<char>(*p);
+		}
+	}
+
+	f_ioData = (p < f_end) ? p : f_end;
+	return str;
+}
+
+// ====================================
+size_t LazyID3v2::getSize(const unsigned char* f_data, size_t f_size)
+{
+	if((f_size < s_headerSize) || memcmp(f_data, "ID3", 3))
+		return 0;
+	if((f_data[3] < 2) || (f_data[3] > 4) || (f_data[4] == 0xFF))
+		return 0;
+	if((f_data[6] | f_data[7] | f_data[8] | f_data[9]) & 0x80)
+		return 0;
+
+	size_t size = s_headerSize + syncsafe32(f_data + 6);
+	if((f_data[3] == 4) && (f_data[5] & Flags::Footer))
+		size += s_footerSize;
+
+	return size;
+}
+
+
+std::unique_ptr<LazyID3v2> LazyID3v2::create(const unsigned char* f_data, size_t f_size)
+{
+	if(!getSize(f_data, f_size))
+		return nullptr;
+
+	std::unique_ptr<LazyID3v2> tag(new LazyID3v2(f_data, f_size));
+	tag->index();
+	tag->m_texts.resize(tag->m_frames.size());
+	tag->m_payloads.resize(tag->m_frames.size());
+	return tag;
+}
+
+
+std::unique_ptr<LazyID3v2> LazyID3v2::create()
+{
+	static const unsigned char s_empty[s_headerSize] = {'I', 'D', '3', 3, 0, 0, 0, 0, 0, 0};
+	return create(s_empty, sizeof(s_empty));
+}
+
+
+LazyID3v2::LazyID3v2(const unsigned char* f_data, size_t f_size):
+	m_data(f_data),
+	m_size(getSize(f_data, f_size)),
+	m_padding(0),
+	m_issues(false),
+	m_modified(false)
+{
+	if(m_size > f_size)
+	{
+		m_size = f_size;
+		m_issues = true;
+	}
+}
+
+
+void LazyID3v2::index()
+{
+	auto version = getMinorVersion();
+	auto flags = m_data[5];
+
+	size_t end = m_size;
+	if((version == 4) && (flags & Flags::Footer) && (end >= s_headerSize + s_footerSize))
+		end -= s_footerSize;
+
+	// Tag-level unsynchronisation hides frame boundaries, so the body has to
+	// be restored before indexing. ID3v2.4 uses per-frame flags instead
+	if((version < 4) && (flags & Flags::Unsynchronisation))
+	{
+		m_unsynced.assign(m_data, m_data + s_headerSize);
+		deunsynchronise(m_data + s_headerSize, end - s_headerSize, m_unsynced);
+		end = m_unsynced.size();
+	}
+	auto p = base();
+
+	size_t pos = s_headerSize;
+	if((version > 2) && (flags & Flags::ExtendedHeader))
+	{
+		if(pos + 4 > end)
+		{
+			m_issues = true;
+			return;
+		}
+		pos += (version == 3) ? (4 + be32(p + pos)) : syncsafe32(p + pos);
+		if(pos > end)
+		{
+			m_issues = true;
+			return;
+		}
+	}
+
+	size_t headerSize = frameHeaderSize();
+	size_t idSize = (version == 2) ? 3 : 4;
+	while(pos + headerSize <= end)
+	{
+		// Padding
+		if(!p[pos])
+			break;
+
+		Frame frame;
+		frame.id.assign(reinterpret_cast<const char*>(p + pos), idSize);
+		for(auto c : frame.id)
+		{
+			if(((c < 'A') || (c > 'Z')) && ((c < '0') || (c > '9')))
+			{
+				m_issues = true;
+				return;
+			}
+		}
+
+		size_t size;
+		switch(version)
+		{
+		case 2:
+			size = be24(p + pos + 3);
+			frame.flags = 0;
+			break;
+		case 3:
+			size = be32(p + pos + 4);
+			frame.flags = (p[pos + 8] << 8) | p[pos + 9];
+			break;
+		default:
+			size = syncsafe32(p + pos + 4);
+			frame.flags = (p[pos + 8] << 8) | p[pos + 9];
+		}
+
+		frame.offset = pos + headerSize;
+		frame.size = size;
+		if(size > end - frame.offset)
+		{
+			m_issues = true;
+			return;
+		}
+
+		m_frames.push_back(frame);
+		pos = frame.offset + size;
+	}
+
+	if(pos < end)
+	{
+		m_padding = end - pos;
+		for(auto i = pos; i < end; ++i)
+		{
+			if(p[i])
+			{
+				m_issues = true;
+				break;
+			}
+		}
+	}
+}
+
+// ====================================
+ByteView LazyID3v2::payload(unsigned f_frame) const
+{
+	auto& frame = m_frames[f_frame];
+	if(frame.replacement)
+		return {frame.replacement->data(), frame.replacement->size()};
+
+	auto p = base() + frame.offset;
+	auto n = frame.size;
+	bool bUnsync = false;
+
+	if(getMinorVersion() == 3)
+	{
+		if(frame.flags & 0xC0) // Compression, encryption
+			return {nullptr, 0};
+		size_t extra = (frame.flags & 0x20) ? 1 : 0;
+		if(extra > n)
+			return {nullptr, 0};
+		p += extra;
+		n -= extra;
+	}
+	else if(getMinorVersion() == 4)
+	{
+		if(frame.flags & 0x0C) // Compression, encryption
+			return {nullptr, 0};
+		size_t extra = ((frame.flags & 0x40) ? 1 : 0) + ((frame.flags & 0x01) ? 4 : 0);
+		if(extra > n)
+			return {nullptr, 0};
+		p += extra;
+		n -= extra;
+		bUnsync = frame.flags & 0x02;
+	}
+
+	if(!bUnsync)
+		return {p, n};
+
+	auto& cache = m_payloads[f_frame];
+	if(!cache)
+	{
+		cache.reset(new std::vector<unsigned char>);
+		deunsynchronise(p, n, *cache);
+	}
+	return {cache->data(), cache->size()};
+}
+
+
+int LazyID3v2::findFrame(const std::string& f_id, unsigned f_index) const
+{
+	for(unsigned i = 0; i < m_frames.size(); ++i)
+	{
+		if(m_frames[i].id != f_id)
+			continue;
+		if(!f_index--)
+			return i;
+	}
+	return -1;
+}
+
+
+unsigned LazyID3v2::getTextCount(const std::string& f_id) const
+{
+	unsigned n = 0;
+	for(auto& frame : m_frames)
+	{
+		if(frame.id == f_id)
+			++n;
+	}
+	return n;
+}
+
+
+const std::string& LazyID3v2::getText(const std::string& f_id, unsigned f_index) const
+{
+	auto i = findFrame(f_id, f_index);
+	if(i < 0)
+		throw std::out_of_range("no \"" + f_id + "\" frame #" + std::to_string(f_index));
+
+	auto& text = m_texts[i];
+	if(text)
+		return *text;
+
+	text.reset(new std::string);
+	auto data = payload(i);
+	if(!data.size)
+		return *text;
+
+	auto p = data.data;
+	auto end = p + data.size;
+	if((f_id[0] == 'W') && (f_id != "WXXX") && (f_id != "WXX"))
+	{
+		// URL frames have no encoding byte
+		*text = decodeString(Encoding::Latin1, p, end, false);
+		return *text;
+	}
+
+	auto encoding = *p++;
+	if((f_id == "COMM") || (f_id == "COM") || (f_id == "USLT") || (f_id == "ULT"))
+	{
+		// Skip a language and a content description
+		p = (end - p > 3) ? p + 3 : end;
+		decodeString(encoding, p, end, true);
+	}
+	else if((f_id == "TXXX") || (f_id == "TXX") || (f_id == "WXXX") || (f_id == "WXX"))
+	{
+		// Skip a description
+		decodeString(encoding, p, end, true);
+		if(f_id[0] == 'W')
+			encoding = Encoding::Latin1;
+	}
+
+	*text = decodeString(encoding, p, end, false);
+	return *text;
+}
+
+
+unsigned LazyID3v2::getPictureCount() const
+{
+	return getTextCount((getMinorVersion() == 2) ? "PIC" : "APIC");
+}
+
+
+ByteView LazyID3v2::getPictureData(unsigned f_index) const
+{
+	bool bV2 = (getMinorVersion() == 2);
+	auto i = findFrame(bV2 ? "PIC" : "APIC", f_index);
+	if(i < 0)
+		throw std::out_of_range("no picture #" + std::to_string(f_index));
+
+	auto data = payload(i);
+	if(!data.size)
+		return data;
+
+	auto p = data.data;
+	auto end = p + data.size;
+	auto encoding = *p++;
+	if(bV2)
+		p = (end - p > 3) ? p + 3 : end;		// Image format
+	else
+		decodeString(Encoding::Latin1, p, end, true);	// MIME type
+	if(p < end)
+		++p;									// Picture type
+	decodeString(encoding, p, end, true);		// Description
+
+	return {p, static_cast<size_t>(end - p)};
+}
+
+// ====================================
+bool LazyID3v2::getCommentLanguage(unsigned f_frame, std::string& f_outLanguage) const
+{
+	auto data = payload(f_frame);
+	if(data.size < 4)
+		return false;
+
+	auto p = data.data;
+	auto end = p + data.size;
+	auto encoding = *p++;
+	f_outLanguage.assign(reinterpret_cast<const char*>(p), 3);
+	p += 3;
+	return decodeString(encoding, p, end, true).empty();
+}
+
+
+std::vector<unsigned char> LazyID3v2::encodeText(const std::string& f_id, const std::string& f_text,
+												 const std::string& f_language) const
+{
+	std::vector<unsigned char> payload;
+
+	// URL frames have no encoding byte
+	if((f_id[0] == 'W') && (f_id != "WXXX") && (f_id != "WXX"))
+	{
+		payload.assign(f_text.begin(), f_text.end());
+		return payload;
+	}
+
+	// ID3v2.4 supports UTF-8, older versions use Latin-1 when possible
+	// and UTF-16 with BOM otherwise
+	unsigned encoding = Encoding::UTF8;
+	std::vector<unsigned> codepoints;
+	if(getMinorVersion() < 4)
+	{
+		encoding = Encoding::Latin1;
+		for(size_t i = 0; i < f_text.size();)
+		{
+			unsigned char c = f_text[i];
+			unsigned n = (c < 0x80) ? 1 : (c < 0xE0) ? 2 : (c < 0xF0) ? 3 : 4;
+			unsigned cp = (n == 1) ? c : (c & (0x7F >> n));
+			for(unsigned k = 1; (k < n) && (i + k < f_text.size()); ++k)
+				cp = (cp << 6) | (f_text[i + k] & 0x3F);
+			i += n;
+
+			codepoints.push_back(cp);
+			if(cp > 0xFF)
+				encoding = Encoding::UTF16;
+		}
+	}
+
+	auto appendTerminator = [&payload, &encoding]()
+	{
+		payload.push_back(0);
+		if(encoding == Encoding::UTF16)
+			payload.push_back(0);
+	};
+	auto appendText = [&payload, &encoding, &codepoints, &f_text]()
+	{
+		if(encoding == Encoding::UTF8)
+			payload.insert(payload.end(), f_text.begin(), f_text.end());
+		else if(encoding == Encoding::Latin1)
+			payload.insert(payload.end(), codepoints.begin(), codepoints.end());
+		else
+		{
+			payload.push_back(0xFF);
+			payload.push_back(0xFE);
+			for(auto cp : codepoints)
+			{
+				if(cp >= 0x10000)
+				{
+					cp -= 0x10000;
+					unsigned hi = 0xD800 + (cp >> 10);
+					payload.push_back(hi & 0xFF);
+					payload.push_back(hi >> 8);
+					cp = 0xDC00 + (cp & 0x3FF);
+				}
+				payload.push_back(cp & 0xFF);
+				payload.push_back(cp >> 8);
+			}
+		}
+	};
+
+	payload.push_back(encoding);
+	if((f_id == "COMM") || (f_id == "COM"))
+	{
+		// Language and an empty content description
+		payload.insert(payload.end(), f_language.begin(), f_language.end());
+		appendTerminator();
+	}
+	appendText();
+
+	return payload;
+}
+
+
+void LazyID3v2::setText(const std::string& f_id, const std::string& f_text)
+{
+	if(f_id.size() != ((getMinorVersion() == 2) ? 3 : 4))
+		throw std::invalid_argument("the frame ID \"" + f_id + "\" doesn't match the ID3v2." + std::to_string(getMinorVersion()) + " tag");
+
+	m_modified = true;
+
+	// Comments with a content description are left alone
+	bool bComment = (f_id == "COMM") || (f_id == "COM");
+	std::string language = "eng";
+	auto isEdited = [&](unsigned f_frame)
+	{
+		return (m_frames[f_frame].id == f_id) && (!bComment || getCommentLanguage(f_frame, language));
+	};
+
+	if(f_text.empty())
+	{
+		for(auto i = m_frames.size(); i--;)
+		{
+			if(!isEdited(i))
+				continue;
+			m_frames.erase(m_frames.begin() + i);
+			m_texts.erase(m_texts.begin() + i);
+			m_payloads.erase(m_payloads.begin() + i);
+		}
+		return;
+	}
+
+	size_t i = 0;
+	while((i < m_frames.size()) && !isEdited(i))
+		++i;
+	if(i == m_frames.size())
+	{
+		language = "eng";
+		m_frames.push_back({f_id, 0, 0, 0, nullptr});
+		m_texts.emplace_back();
+		m_payloads.emplace_back();
+	}
+
+	auto& frame = m_frames[i];
+	frame.replacement = std::make_shared<std::vector<unsigned char>>(encodeText(f_id, f_text, language));
+	frame.size = frame.replacement->size();
+	// Format flags (compression, unsynchronisation, ...) don't apply anymore
+	frame.flags &= 0xFF00;
+	m_texts[i].reset();
+	m_payloads[i].reset();
+}
+
+
+size_t LazyID3v2::getRequiredSize() const
+{
+	size_t size = s_headerSize;
+	for(auto& frame : m_frames)
+		size += frameHeaderSize() + frame.size;
+	return size;
+}
+
+// ====================================
+void LazyID3v2::serialize(std::vector<unsigned char>& f_outStream) const
+{
+	if(m_modified)
+		serialize(f_outStream, std::max(getRequiredSize(), m_size));
+	else
+		f_outStream.insert(f_outStream.end(), m_data, m_data + m_size);
+}
+
+
+void LazyID3v2::serialize(std::vector<unsigned char>& f_outStream, size_t f_size) const
+{
+	if(f_size < getRequiredSize())
+		throw std::length_error("the ID3v2 tag doesn't fit " + std::to_string(f_size) + " bytes");
+	// 28-bit syncsafe size without the header
+	if(f_size - s_headerSize > s_maxSyncsafe)
+		throw std::length_error("the ID3v2 tag of " + std::to_string(f_size) + " bytes exceeds the maximum size");
+
+	auto version = getMinorVersion();
+	auto begin = f_outStream.size();
+	f_outStream.reserve(begin + f_size);
+
+	// Header
+	f_outStream.insert(f_outStream.end(), m_data, m_data + 5);
+	f_outStream.push_back(m_data[5] & ~(Flags::Unsynchronisation | Flags::ExtendedHeader | Flags::Footer));
+	auto size = f_size - s_headerSize;
+	f_outStream.insert(f_outStream.end(), {static_cast<unsigned char>((size >> 21) & 0x7F),
+										   static_cast<unsigned char>((size >> 14) & 0x7F),
+										   static_cast<unsigned char>((size >> 7) & 0x7F),
+										   static_cast<unsigned char>(size & 0x7F)});
+
+	// Frames
+	auto headerSize = frameHeaderSize();
+	for(auto& frame : m_frames)
+	{
+		if(!frame.replacement)
+		{
+			auto p = base() + frame.offset - headerSize;
+			f_outStream.insert(f_outStream.end(), p, p + headerSize + frame.size);
+			continue;
+		}
+
+		f_outStream.insert(f_outStream.end(), frame.id.begin(), frame.id.end());
+		auto n = frame.size;
+		if(n > ((version == 2) ? 0xFFFFFF : (version == 3) ? 0xFFFFFFFF : s_maxSyncsafe))
+			throw std::length_error("the ID3v2 frame \"" + frame.id + "\" of " + std::to_string(n) + " bytes exceeds the maximum size");
+		switch(version)
+		{
+		case 2:
+			f_outStream.insert(f_outStream.end(), {static_cast<unsigned char>(n >> 16),
+												   static_cast<unsigned char>(n >> 8),
+												   static_cast<unsigned char>(n)});
+			break;
+		case 3:
+			f_outStream.insert(f_outStream.end(), {static_cast<unsigned char>(n >> 24),
+												   static_cast<unsigned char>(n >> 16),
+												   static_cast<unsigned char>(n >> 8),
+												   static_cast<unsigned char>(n)});
+			break;
+		default:
+			f_outStream.insert(f_outStream.end(), {static_cast<unsigned char>((n >> 21) & 0x7F),
+												   static_cast<unsigned char>((n >> 14) & 0x7F),
+												   static_cast<unsigned char>((n >> 7) & 0x7F),
+												   static_cast<unsigned char>(n & 0x7F)});
+		}
+		if(version > 2)
+		{
+			f_outStream.push_back(frame.flags >> 8);
+			f_outStream.push_back(frame.flags & 0xFF);
+		}
+		f_outStream.insert(f_outStream.end(), frame.replacement->begin(), frame.replacement->end());
+	}
+
+	// Padding
+	f_outStream.resize(begin + f_size, 0);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "file.h"
+
+
+// ID3v2 tag which is indexed by frame offsets only. Frame contents are
+// decoded on the first access and pictures are returned as views into the
+// source buffer, so the source must outlive the object.
+class LazyID3v2 final
+{
+public:
+	struct Frame
+	{
+		std::string	id;
+		size_t		offset;	// Payload offset relative to the tag start
+		size_t		size;	// Payload size
+		unsigned	flags;
+
+		// Payload of a frame which has been set after parsing
+		std::shared_ptr<std::vector<unsigned char>>	replacement;
+	};
+
+public:
+	// Return the whole tag size (header, frames, padding and footer) or 0
+	static size_t						getSize	(const unsigned char* f_data, size_t f_size);
+	// Return nullptr if there is no tag in the beginning of the f_data
+	static std::unique_ptr<LazyID3v2>	create	(const unsigned char* f_data, size_t f_size);
+	// Create an empty ID3v2.3 tag
+	static std::unique_ptr<LazyID3v2>	create	();
+
+public:
+	bool				hasIssues		() const { return m_issues; }
+
+	size_t				getSize			() const { return m_size; }
+	size_t				getPaddingSize	() const { return m_padding; }
+
+	unsigned			getMinorVersion	() const { return m_data[3]; }
+	unsigned			getRevision		() const { return m_data[4]; }
+
+	const std::vector<Frame>&	frames	() const { return m_frames; }
+
+	// Text frames are addressed by the version-specific ID ("TIT2", "TT2", ...)
+	unsigned			getTextCount	(const std::string& f_id) const;
+	const std::string&	getText			(const std::string& f_id, unsigned f_index) const;
+
+	unsigned			getPictureCount	() const;
+	ByteView			getPictureData	(unsigned f_index) const;
+
+	// Replace the first frame with the f_id or append a new one. An empty
+	// text removes all such frames. Only comments without a content
+	// description are edited, a replaced comment keeps its language and a
+	// new one is in English. Throws std::invalid_argument if the ID doesn't
+	// match the tag version
+	void				setText			(const std::string& f_id, const std::string& f_text);
+
+	bool				isModified		() const { return m_modified; }
+	// The size of the header and frames, i.e. the minimal serialized size
+	size_t				getRequiredSize	() const;
+
+	// A raw copy of the source bytes unless the tag has been modified
+	void				serialize		(std::vector<unsigned char>& f_outStream) const;
+	// Serialize the tag padded to the f_size, which must not be less than
+	// the required size. The extended header and the footer are dropped.
+	// Throws std::length_error if the tag or a frame is too large for its
+	// size field
+	void				serialize		(std::vector<unsigned char>& f_outStream, size_t f_size) const;
+
+private:
+	LazyID3v2(const unsigned char* f_data, size_t f_size);
+
+	void				index			();
+	int					findFrame		(const std::string& f_id, unsigned f_index) const;
+	const unsigned char*	base		() const { return m_unsynced.empty() ? m_data : m_unsynced.data(); }
+	// Payload without the extra frame header fields and unsynchronisation.
+	// Returns an empty view for compressed or encrypted frames
+	ByteView			payload			(unsigned f_frame) const;
+	size_t				frameHeaderSize	() const { return (getMinorVersion() == 2) ? 6 : 10; }
+	// Comment frame without a content description with its language
+	bool				getCommentLanguage	(unsigned f_frame, std::string& f_outLanguage) const;
+	std::vector<unsigned char>	encodeText	(const std::string& f_id, const std::string& f_text, const std::string& f_language) const;
+
+private:
+	const unsigned char*	m_data;
+	size_t					m_size;
+	size_t					m_padding;
+	bool					m_issues;
+	bool					m_modified;
+
+	// De-unsynchronised copy of the whole tag (ID3v2.2 / ID3v2.3 only)
+	std::vector<unsigned char>	m_unsynced;
+
+	std::vector<Frame>			m_frames;
+
+	// Per-frame caches filled on the first access
+	mutable std::vector<std::unique_ptr<std::string>>					m_texts;
+	mutable std::vector<std::unique_ptr<std::vector<unsigned char>>>	m_payloads;
+};
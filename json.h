@@ -0,0 +1,24 @@
+#pragma once
+
+
+#include <sstream>
+#include <string>
+
+
+// A JSON string literal of the f_str
+inline std::string quoteJSON(const std::string& f_str)
+{
+	std::ostringstream os;
+	os << '"';
+	for(unsigned char c : f_str)
+	{
+		if(c == '"' || c == '\\')
+			os << '\\' << c;
+		else if(c < 0x20)
+			os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0x0F];
+		else
+			os << c;
+	}
+	os << '"';
+	return os.str();
+}
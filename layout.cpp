@@ -0,0 +1,169 @@
+#include "layout.h"
+
+#include "id3v2.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+static const size_t s_id3v1Size			= 128;
+static const size_t s_apeFooterSize		= 32;
+static const size_t s_lyricsFooterSize	= 15; // 6 digits size + "LYRICS200"
+static const size_t s_lyricsHeaderSize	= 11; // "LYRICSBEGIN"
+
+
+static size_t le32(const unsigned char* f_data)
+{
+	return (static_cast<size_t>(f_data[3]) << 24) | (f_data[2] << 16) | (f_data[1] << 8) | f_data[0];
+}
+
+
+enum class Probe
+{
+	None,
+	Found,
+	More	// The window doesn't cover the tag
+};
+
+
+// Resolve one trailing tag ending at the f_end. The f_window holds the file
+// bytes from the f_windowOffset up to the end of the file. If the window is
+// too short, the f_outNeeded is set to the offset it has to start from
+static Probe probeTrailingTag(const unsigned char* f_window, size_t f_windowOffset,
+							  size_t f_begin, size_t f_end, Layout& f_ioLayout, size_t& f_outNeeded)
+{
+	auto avail = f_end - f_begin;
+	auto at = [f_window, f_windowOffset](size_t f_offset) { return f_window + (f_offset - f_windowOffset); };
+
+	// All the footers must be in the window
+	auto footers = f_end - std::min(avail, s_id3v1Size);
+	if(footers < f_windowOffset)
+	{
+		f_outNeeded = footers;
+		return Probe::More;
+	}
+
+	if(!f_ioLayout.id3v1Size && (avail >= s_id3v1Size) && !memcmp(at(f_end - s_id3v1Size), "TAG", 3))
+	{
+		f_ioLayout.id3v1Offset = f_end - s_id3v1Size;
+		f_ioLayout.id3v1Size = s_id3v1Size;
+		return Probe::Found;
+	}
+
+	if(!f_ioLayout.apeSize && (avail >= s_apeFooterSize) && !memcmp(at(f_end - s_apeFooterSize), "APETAGEX", 8))
+	{
+		auto footer = at(f_end - s_apeFooterSize);
+		// The size includes the footer but not the optional header
+		auto size = le32(footer + 12);
+		if(le32(footer + 20) & 0x80000000)
+			size += s_apeFooterSize;
+		if((size < s_apeFooterSize) || (size > avail))
+		{
+			f_ioLayout.trailerIssues = true;
+			return Probe::None;
+		}
+		f_ioLayout.apeOffset = f_end - size;
+		f_ioLayout.apeSize = size;
+		return Probe::Found;
+	}
+
+	if(!f_ioLayout.lyricsSize && (avail >= s_lyricsFooterSize) && !memcmp(at(f_end - 9), "LYRICS200", 9))
+	{
+		size_t size = 0;
+		for(auto d = at(f_end - s_lyricsFooterSize); d < at(f_end - 9); ++d)
+		{
+			if((*d < '0') || (*d > '9'))
+			{
+				f_ioLayout.trailerIssues = true;
+				return Probe::None;
+			}
+			size = size * 10 + (*d - '0');
+		}
+		size += s_lyricsFooterSize;
+		if((size > avail) || (size < s_lyricsFooterSize + s_lyricsHeaderSize))
+		{
+			f_ioLayout.trailerIssues = true;
+			return Probe::None;
+		}
+		if(f_end - size < f_windowOffset)
+		{
+			f_outNeeded = f_end - size;
+			return Probe::More;
+		}
+		if(memcmp(at(f_end - size), "LYRICSBEGIN", s_lyricsHeaderSize))
+		{
+			f_ioLayout.trailerIssues = true;
+			return Probe::None;
+		}
+		f_ioLayout.lyricsOffset = f_end - size;
+		f_ioLayout.lyricsSize = size;
+		return Probe::Found;
+	}
+
+	return Probe::None;
+}
+
+
+Layout Layout::probe(const unsigned char* f_data, size_t f_size)
+{
+	Layout layout;
+	layout.fileSize = f_size;
+
+	layout.probeHead(f_data, f_size);
+
+	size_t needed;
+	bool bComplete = layout.probeTrailer(f_data, f_size, needed);
+	ASSERT(bComplete);
+
+	return layout;
+}
+
+
+void Layout::probeHead(const unsigned char* f_head, size_t f_headSize)
+{
+	id3v2Offset = 0;
+	id3v2Size = LazyID3v2::getSize(f_head, f_headSize);
+	if(id3v2Size > fileSize)
+	{
+		id3v2Size = fileSize;
+		id3v2Overrun = true;
+	}
+}
+
+
+bool Layout::probeTrailer(const unsigned char* f_tail, size_t f_tailSize, size_t& f_outNeeded)
+{
+	ASSERT(f_tailSize <= fileSize);
+	auto windowOffset = fileSize - f_tailSize;
+
+	apeOffset = apeSize = 0;
+	lyricsOffset = lyricsSize = 0;
+	id3v1Offset = id3v1Size = 0;
+
+	size_t begin = id3v2Offset + id3v2Size;
+	size_t end = fileSize;
+	for(;;)
+	{
+		size_t needed;
+		auto probe = probeTrailingTag(f_tail, windowOffset, begin, end, *this, needed);
+		if(probe == Probe::None)
+			break;
+		if(probe == Probe::More)
+		{
+			f_outNeeded = fileSize - needed;
+			return false;
+		}
+
+		end = std::min({end,
+						id3v1Size	? id3v1Offset	: end,
+						apeSize		? apeOffset		: end,
+						lyricsSize	? lyricsOffset	: end});
+	}
+
+	mpegOffset = begin;
+	mpegSize = end - begin;
+
+	return true;
+}
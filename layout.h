@@ -0,0 +1,50 @@
+#pragma once
+
+
+#include <cstddef>
+
+
+// Byte layout of an MP3 file: a leading ID3v2 tag, MPEG data and a trailing
+// chain of APE, Lyrics3v2 and ID3v1 tags in any order. Tags are detected by
+// their headers and footers only, i.e. no tag contents are parsed.
+// The size of an absent tag is zero
+struct Layout
+{
+	size_t	fileSize		= 0;
+
+	size_t	id3v2Offset		= 0;
+	size_t	id3v2Size		= 0;
+
+	size_t	mpegOffset		= 0;
+	size_t	mpegSize		= 0;
+
+	size_t	apeOffset		= 0;
+	size_t	apeSize			= 0;
+
+	size_t	lyricsOffset	= 0;
+	size_t	lyricsSize		= 0;
+
+	size_t	id3v1Offset		= 0;
+	size_t	id3v1Size		= 0;
+
+	// The ID3v2 size exceeds the file, the id3v2Size is cut to the file size
+	bool	id3v2Overrun	= false;
+	// A trailing tag is truncated or overlaps another one
+	bool	trailerIssues	= false;
+
+	size_t	trailerOffset	() const { return mpegOffset + mpegSize; }
+	size_t	trailerSize		() const { return fileSize - trailerOffset(); }
+	bool	hasIssues		() const { return id3v2Overrun || trailerIssues; }
+	// A tag of the f_size may replace the ID3v2 tag in place: the tag ends
+	// within the file and the f_size fits it including its padding
+	bool	canPatchID3v2	(size_t f_size) const { return id3v2Size && !id3v2Overrun && (f_size <= id3v2Size); }
+
+	// Probe a whole file
+	static Layout	probe			(const unsigned char* f_data, size_t f_size);
+
+	// Probe a file piecewise: the head (the fileSize must be set) and then
+	// the last f_tailSize bytes. Return false if the tail doesn't cover
+	// all the trailing tags, then the f_outNeeded is the tail size to retry
+	void			probeHead		(const unsigned char* f_head, size_t f_headSize);
+	bool			probeTrailer	(const unsigned char* f_tail, size_t f_tailSize, size_t& f_outNeeded);
+};
@@ -2,6 +2,9 @@
 
 #include "common.h"
 
+#include <cerrno>
+#include <cstdlib>
+
 
 template<typename T>
 static T orEnums(T f_e0, T f_e1)
@@ -10,16 +13,31 @@ static T orEnums(T f_e0, T f_e1)
 }
 
 
-static std::unique_ptr<Command> parseInfoArgs(const std::string& f_pathIn,
-											  const char* f_args[], uint f_nArgs,
-											  uint& f_ioCurArg)
+// Input files of a batch command: the arguments up to the next option and
+// the f_pathIn
+static bool parsePathArgs(const std::string& f_pathIn,
+						  const char* f_args[], uint f_nArgs,
+						  uint& f_ioCurArg, std::vector<std::string>& f_outPaths)
 {
-	if(f_pathIn.empty())
+	for(; (f_ioCurArg < f_nArgs) && (f_args[f_ioCurArg][0] != '-'); ++f_ioCurArg)
+		f_outPaths.push_back(f_args[f_ioCurArg]);
+	if(!f_pathIn.empty())
+		f_outPaths.push_back(f_pathIn);
+
+	if(f_outPaths.empty())
 	{
 		ERROR("no input file specified");
-		return nullptr;
+		return false;
 	}
 
+	return true;
+}
+
+
+static std::unique_ptr<Command> parseInfoArgs(const std::string& f_pathIn,
+											  const char* f_args[], uint f_nArgs,
+											  uint& f_ioCurArg)
+{
 	auto mask = CmdInfo::FieldsMask::All;
 
 	for(++f_ioCurArg; f_ioCurArg < f_nArgs; ++f_ioCurArg)
@@ -40,7 +58,12 @@ static std::unique_ptr<Command> parseInfoArgs(const std::string& f_pathIn,
 			break;
 	}
 
-	return std::make_unique<CmdInfo>(f_pathIn, mask);
+	// More input files may follow the fields
+	std::vector<std::string> paths;
+	if( !parsePathArgs(f_pathIn, f_args, f_nArgs, f_ioCurArg, paths) )
+		return nullptr;
+
+	return std::make_unique<CmdInfo>(paths, mask);
 }
 
 
@@ -101,6 +124,234 @@ static std::unique_ptr<Command> parseCutFramesArgs(const std::string& f_pathIn,
 }
 
 
+// Seconds without a suffix or with the "s" suffix, milliseconds with the "ms"
+// suffix or samples with the "smp" suffix
+static bool parsePosition(const char* f_arg, SamplePosition& f_outPosition)
+{
+	char* end;
+	errno = 0;
+	auto value = strtod(f_arg, &end);
+	if((end == f_arg) || errno || (value < 0))
+		return false;
+
+	std::string suffix(end);
+	if(suffix.empty() || (suffix == "s"))
+		f_outPosition = {value, SamplePosition::Unit::Seconds};
+	else if(suffix == "ms")
+		f_outPosition = {value, SamplePosition::Unit::Milliseconds};
+	else if((suffix == "smp") && (value == static_cast<uint64_t>(value)))
+		f_outPosition = {value, SamplePosition::Unit::Samples};
+	else
+		return false;
+
+	return true;
+}
+
+
+static std::unique_ptr<Command> parseCutSamplesArgs(const std::string& f_pathIn, const std::string& f_pathOut,
+													const char* f_args[], uint f_nArgs,
+													uint& f_ioCurArg)
+{
+	if(f_pathIn.empty())
+	{
+		ERROR("no input file specified");
+		return nullptr;
+	}
+
+	SamplePosition positions[2];
+	const char* names[2] = {"begin", "end"};
+	for(unsigned i = 0; i < 2; ++i)
+	{
+		if(++f_ioCurArg >= f_nArgs)
+		{
+			ERROR("no " << names[i] << " position is specified");
+			return nullptr;
+		}
+		if( !parsePosition(f_args[f_ioCurArg], positions[i]) )
+		{
+			ERROR("the " << names[i] << " position \"" << f_args[f_ioCurArg] << "\" is invalid");
+			return nullptr;
+		}
+	}
+
+	++f_ioCurArg;
+	return std::make_unique<CmdCutSamples>(f_pathIn, f_pathOut, positions[0], positions[1]);
+}
+
+
+static std::unique_ptr<Command> parseVerifyArgs(const std::string& f_pathIn,
+												const char* f_args[], uint f_nArgs,
+												uint& f_ioCurArg)
+{
+	std::vector<std::string> paths;
+	if( !parsePathArgs(f_pathIn, f_args, f_nArgs, ++f_ioCurArg, paths) )
+		return nullptr;
+
+	return std::make_unique<CmdVerify>(paths);
+}
+
+
+static std::unique_ptr<Command> parseHashArgs(const std::string& f_pathIn,
+											  const char* f_args[], uint f_nArgs,
+											  uint& f_ioCurArg)
+{
+	bool bSegments = false;
+	if((++f_ioCurArg < f_nArgs) && (std::string(f_args[f_ioCurArg]) == "segments"))
+	{
+		bSegments = true;
+		++f_ioCurArg;
+	}
+
+	std::vector<std::string> paths;
+	if( !parsePathArgs(f_pathIn, f_args, f_nArgs, f_ioCurArg, paths) )
+		return nullptr;
+
+	return std::make_unique<CmdHash>(paths, bSegments);
+}
+
+
+static std::unique_ptr<Command> parseStatsFramesArgs(const std::string& f_pathIn,
+													 const char* f_args[], uint f_nArgs,
+													 uint& f_ioCurArg)
+{
+	std::vector<std::string> paths;
+	if( !parsePathArgs(f_pathIn, f_args, f_nArgs, ++f_ioCurArg, paths) )
+		return nullptr;
+
+	return std::make_unique<CmdStatsFrames>(paths);
+}
+
+
+static bool parseTagFieldArg(const char* f_args[], uint f_nArgs, uint& f_ioCurArg,
+							 std::vector<CmdEditTags::Field>& f_ioFields)
+{
+	if(++f_ioCurArg >= f_nArgs)
+	{
+		ERROR("no tag field is specified");
+		return false;
+	}
+
+	std::string arg(f_args[f_ioCurArg]);
+	auto pos = arg.find('=');
+	if(pos == std::string::npos)
+	{
+		ERROR("the value \"" << arg << "\" is invalid (\"field=value\" is expected)");
+		return false;
+	}
+
+	auto name = arg.substr(0, pos);
+	if(!CmdEditTags::isField(name))
+	{
+		ERROR("unknown tag field \"" << name << '"');
+		return false;
+	}
+
+	f_ioFields.emplace_back(name, arg.substr(pos + 1));
+	++f_ioCurArg;
+	return true;
+}
+
+
+static bool parseSizeArg(const char* f_args[], uint f_nArgs, uint& f_ioCurArg, size_t& f_outSize)
+{
+	if(++f_ioCurArg >= f_nArgs)
+	{
+		ERROR("no size is specified");
+		return false;
+	}
+
+	try
+	{
+		size_t errIndex;
+		auto size = std::stol(f_args[f_ioCurArg], &errIndex, 0);
+		if(size < 0)
+			throw std::out_of_range("the size can't be negative");
+		if(char c = f_args[f_ioCurArg][errIndex])
+			throw std::invalid_argument(std::string("unexpected character '") + std::string(1, c) + "'");
+		f_outSize = size;
+	}
+	catch(const std::invalid_argument& e)
+	{
+		ERROR("the value \"" << f_args[f_ioCurArg] << "\" is invalid (" << e.what() << ')');
+		return false;
+	}
+	catch(const std::out_of_range& e)
+	{
+		ERROR("the value \"" << f_args[f_ioCurArg] << "\" is out of bounds (" << e.what() << ')');
+		return false;
+	}
+
+	++f_ioCurArg;
+	return true;
+}
+
+
+static std::unique_ptr<Command> parseSeekIndexArgs(const std::string& f_pathIn, const std::string& f_pathOut,
+												   const char* f_args[], uint f_nArgs,
+												   uint& f_ioCurArg)
+{
+	if(f_pathIn.empty())
+	{
+		ERROR("no input file specified");
+		return nullptr;
+	}
+
+	// An optional interval
+	size_t interval = 250;
+	if((f_ioCurArg + 1 < f_nArgs) && (f_args[f_ioCurArg + 1][0] != '-'))
+	{
+		if( !parseSizeArg(f_args, f_nArgs, f_ioCurArg, interval) )
+			return nullptr;
+	}
+	else
+		++f_ioCurArg;
+
+	if(!interval || (interval > UINT32_MAX))
+	{
+		ERROR("the seek index interval is out of bounds");
+		return nullptr;
+	}
+
+	return std::make_unique<CmdSeekIndex>(f_pathIn, f_pathOut, interval);
+}
+
+
+static std::unique_ptr<Command> parseSeekArgs(const std::string& f_pathIn,
+											  const char* f_args[], uint f_nArgs,
+											  uint& f_ioCurArg)
+{
+	if(f_pathIn.empty())
+	{
+		ERROR("no input file specified");
+		return nullptr;
+	}
+
+	SamplePosition position;
+	if((++f_ioCurArg >= f_nArgs) || !parsePosition(f_args[f_ioCurArg], position))
+	{
+		ERROR("no valid position to seek to is specified");
+		return nullptr;
+	}
+
+	++f_ioCurArg;
+	return std::make_unique<CmdSeek>(f_pathIn, position);
+}
+
+
+static std::unique_ptr<Command> parseTrimSilenceArgs(const std::string& f_pathIn, const std::string& f_pathOut,
+													 uint& f_ioCurArg)
+{
+	if(f_pathIn.empty())
+	{
+		ERROR("no input file specified");
+		return nullptr;
+	}
+
+	++f_ioCurArg;
+	return std::make_unique<CmdTrimSilence>(f_pathIn, f_pathOut);
+}
+
+
 static bool parseOutArgs(const char* f_args[], uint f_nArgs, std::string& f_outPathOut)
 {
 	std::string pathOut;
@@ -163,6 +414,11 @@ static std::unique_ptr<const Command> parseArgs(uint f_nArgs, const char* f_args
 
 	std::unique_ptr<Command> sp;
 	bool bForce = false;
+	bool bPlan = false;
+
+	std::vector<CmdEditTags::Field> tagFields;
+	size_t tagPadding = 4096;
+	bool bTagPadding = false;
 
 	for(uint i = 0; i < nArgs;)
 	{
@@ -174,6 +430,12 @@ static std::unique_ptr<const Command> parseArgs(uint f_nArgs, const char* f_args
 			++i;
 			continue;
 		}
+		else if(cmd == "--plan")
+		{
+			bPlan = true;
+			++i;
+			continue;
+		}
 		else if(cmd == "-h")
 		{
 			if(sp)
@@ -196,6 +458,15 @@ static std::unique_ptr<const Command> parseArgs(uint f_nArgs, const char* f_args
 				return nullptr;
 			continue;
 		}
+		else if(cmd == "-C")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseCutSamplesArgs(fileIn, fileOut, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
 		else if(cmd == "-i")
 		{
 			if(sp)
@@ -205,10 +476,91 @@ static std::unique_ptr<const Command> parseArgs(uint f_nArgs, const char* f_args
 				return nullptr;
 			continue;
 		}
+		else if(cmd == "--verify")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseVerifyArgs(fileIn, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--hash")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseHashArgs(fileIn, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--stats-frames")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseStatsFramesArgs(fileIn, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--seek-index")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseSeekIndexArgs(fileIn, fileOut, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--seek")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseSeekArgs(fileIn, f_args, nArgs, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--trim-silence")
+		{
+			if(sp)
+				return invalidOp(cmd);
+			sp = parseTrimSilenceArgs(fileIn, fileOut, i);
+			if(!sp)
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--set")
+		{
+			if( !parseTagFieldArg(f_args, nArgs, i, tagFields) )
+				return nullptr;
+			continue;
+		}
+		else if(cmd == "--padding")
+		{
+			if( !parseSizeArg(f_args, nArgs, i, tagPadding) )
+				return nullptr;
+			bTagPadding = true;
+			continue;
+		}
 
 		return invalidOp(cmd);
 	}
 
+	if(!tagFields.empty())
+	{
+		if(sp)
+			return invalidOp("--set");
+		if(fileIn.empty())
+		{
+			ERROR("no input file specified");
+			return nullptr;
+		}
+		sp = std::make_unique<CmdEditTags>(fileIn, fileOut, tagFields, tagPadding);
+	}
+	else if(bTagPadding)
+		return invalidOp("--padding");
+
 	if(!sp)
 	{
 		ERROR("no command specified");
@@ -217,8 +569,14 @@ static std::unique_ptr<const Command> parseArgs(uint f_nArgs, const char* f_args
 
 	if(bForce)
 		sp->suppressWarnings();
+	if(bPlan)
+	{
+		if(!sp->canPlan())
+			return invalidOp("--plan");
+		sp->planOnly();
+	}
 
-	return std::move(sp);
+	return sp;
 }
 
 // ============================================================================
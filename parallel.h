@@ -0,0 +1,58 @@
+#pragma once
+
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Call the f_fn(i) for every i in [0, f_count) using a pool of threads.
+// Items are handed out one by one, so uneven items (e.g. files) balance well.
+// The number of threads defaults to the number of CPUs
+template<typename Fn>
+void parallelFor(size_t f_count, Fn f_fn, size_t f_threads = 0)
+{
+	size_t nThreads = f_threads ? f_threads : std::thread::hardware_concurrency();
+	if(nThreads > f_count)
+		nThreads = f_count;
+	if(nThreads < 2)
+	{
+		for(size_t i = 0; i < f_count; ++i)
+			f_fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	auto worker = [&]()
+	{
+		for(size_t i; (i = next++) < f_count;)
+		{
+			try
+			{
+				f_fn(i);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if(!error)
+					error = std::current_exception();
+				next = f_count;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(size_t i = 1; i < nThreads; ++i)
+		threads.emplace_back(worker);
+	worker();
+
+	for(auto& thread : threads)
+		thread.join();
+
+	if(error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,252 @@
+#include "report.h"
+
+#include "id3v2.h"
+#include "frames.h"
+#include "json.h"
+#include "parallel.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+
+static const unsigned s_verifyChunkFrames = 4096;
+
+
+// The tail starts with a header of a frame of the stream which doesn't fit.
+// A free format frame is as large as the last one
+static bool isIncompleteFrame(const unsigned char* f_data, const FrameTable& f_table)
+{
+	FrameHeader last;
+	FrameHeader header;
+	if((f_table.tailSize < FrameHeader::headerSize) || !FrameHeader::parse(f_data + f_table.offsets.back(), last) ||
+	   !FrameHeader::parse(f_data + f_table.tailOffset, header) || !header.isCompatible(last))
+		return false;
+	auto size = header.isFreeFormat() ? f_table.sizes.back() : header.size;
+	return size > f_table.tailSize;
+}
+
+
+#define ISSUE(msg)	do { std::ostringstream os; os << msg; f_outIssues.push_back(os.str()); } while(0)
+#define AT(offset)	"@ " << (offset) << " (0x" << OUT_HEX(offset) << ")"
+
+bool verifyFile(const LoadedFile& f_file, bool f_parallel, unsigned& f_outFrames, std::vector<std::string>& f_outIssues)
+{
+	f_outFrames = 0;
+
+	if(!f_file.error.empty())
+	{
+		ISSUE(f_file.error);
+		return false;
+	}
+
+	auto& layout = f_file.layout;
+	if(layout.id3v2Overrun)
+		ISSUE(AT(layout.id3v2Offset) << " ID3v2 tag size exceeds the file size of " << layout.fileSize << " bytes");
+	if(layout.trailerIssues)
+		ISSUE("trailing tags are truncated or overlap");
+	if(layout.id3v2Size)
+	{
+		auto id3v2 = LazyID3v2::create(f_file.id3v2.data, f_file.id3v2.size);
+		if(id3v2->hasIssues())
+			ISSUE(AT(layout.id3v2Offset) << " ID3v2 tag has malformed frames");
+	}
+
+	auto data = f_file.mpeg.data;
+	auto base = layout.mpegOffset;
+	auto table = FrameTable::walk(data, layout.mpegSize);
+	f_outFrames = table.getFrameCount();
+	if(!f_outFrames)
+	{
+		ISSUE("no MPEG frames");
+		return true;
+	}
+
+	for(auto& gap : table.gaps)
+	{
+		if(gap.offset)
+			ISSUE(AT(base + gap.offset) << " lost sync, " << gap.size << " bytes skipped");
+		else
+			ISSUE(AT(base) << " " << gap.size << " bytes of junk before the first frame");
+	}
+	if(table.tailSize)
+	{
+		if(isIncompleteFrame(data, table))
+			ISSUE(AT(base + table.tailOffset) << " truncated final frame, " << table.tailSize << " bytes");
+		else
+			ISSUE(AT(base + table.tailOffset) << " " << table.tailSize << " bytes of junk after the last frame");
+	}
+
+	// CRC of protected frames
+	unsigned nChunks = (f_outFrames + s_verifyChunkFrames - 1) / s_verifyChunkFrames;
+	std::vector<std::vector<std::string>> chunkIssues(nChunks);
+	auto checkChunk = [&](size_t f_chunk)
+	{
+		auto& issues = chunkIssues[f_chunk];
+		auto end = std::min<size_t>((f_chunk + 1) * s_verifyChunkFrames, f_outFrames);
+		for(auto i = f_chunk * s_verifyChunkFrames; i < end; ++i)
+		{
+			auto frame = data + table.offsets[i];
+			// The CRC of Layer I/II frames covers the bit allocation, which is
+			// not parsed
+			FrameHeader header;
+			if(!FrameHeader::parse(frame, header) || !header.protection || (header.layer != 3))
+				continue;
+
+			unsigned short stored = (frame[4] << 8) | frame[5];
+			auto calculated = calcFrameCRC(frame, header);
+			if(stored == calculated)
+				continue;
+
+			std::ostringstream os;
+			os << AT(base + table.offsets[i]) << " frame #" << i << " CRC mismatch (stored 0x" <<
+				  OUT_HEX(stored) << ", calculated 0x" << OUT_HEX(calculated) << ')';
+			issues.push_back(os.str());
+		}
+	};
+	if(f_parallel)
+		parallelFor(nChunks, checkChunk);
+	else
+	{
+		for(unsigned i = 0; i < nChunks; ++i)
+			checkChunk(i);
+	}
+	for(auto& issues : chunkIssues)
+		f_outIssues.insert(f_outIssues.end(), issues.begin(), issues.end());
+
+	// Xing/Info header counts. Encoders disagree whether the header frame
+	// itself is counted, so both variants are accepted
+	XingHeader xing;
+	if(XingHeader::parse(data + table.offsets[0], table.sizes[0], xing))
+	{
+		if((xing.flags & XingHeader::Flags::Frames) &&
+		   (xing.frames != f_outFrames) && (xing.frames != f_outFrames - 1))
+			ISSUE(AT(base + table.offsets[0] + xing.offset) << " Xing header declares " << xing.frames <<
+				  " frames, " << (f_outFrames - 1) << " found");
+
+		size_t bytes = table.offsets.back() + table.sizes.back() - table.offsets[0];
+		if((xing.flags & XingHeader::Flags::Bytes) &&
+		   (xing.bytes != bytes) && (xing.bytes != bytes - table.sizes[0]) && (xing.bytes != layout.fileSize))
+			ISSUE(AT(base + table.offsets[0] + xing.offset) << " Xing header declares " << xing.bytes <<
+				  " bytes, " << bytes << " found");
+	}
+
+	return true;
+}
+
+#undef AT
+#undef ISSUE
+
+// ====================================
+// Value at the f_percent of the sorted f_values (nearest rank)
+static unsigned getPercentile(std::vector<unsigned>& f_values, unsigned f_percent)
+{
+	auto rank = (f_values.size() * f_percent + 99) / 100;
+	auto it = f_values.begin() + (rank ? rank - 1 : 0);
+	std::nth_element(f_values.begin(), it, f_values.end());
+	return *it;
+}
+
+
+// The per-frame data is reduced to the frame size and bitrate arrays, so the
+// statistics are computed with simple loops over them
+std::string getFrameStats(const LoadedFile& f_file)
+{
+	std::ostringstream os;
+	os << "{\"path\":" << quoteJSON(f_file.path);
+	if(!f_file.error.empty())
+	{
+		os << ",\"error\":" << quoteJSON(f_file.error) << '}';
+		return os.str();
+	}
+
+	auto data = f_file.mpeg.data;
+	auto table = FrameTable::walk(data, f_file.mpeg.size);
+	unsigned nFrames = table.getFrameCount();
+	XingHeader xing;
+	bool bXing = nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing);
+	unsigned first = bXing ? 1 : 0;
+
+	// Junk is anything between, before or after the frames
+	size_t junk = table.tailSize;
+	for(auto& gap : table.gaps)
+		junk += gap.size;
+
+	os << ",\"frames\":" << nFrames - first << ",\"xing\":" << (bXing ? "true" : "false");
+	if(first == nFrames)
+	{
+		os << ",\"junkBytes\":" << junk << '}';
+		return os.str();
+	}
+
+	FrameHeader header;
+	FrameHeader::parse(data + table.offsets[first], header);
+
+	std::vector<unsigned> sizes(table.sizes.begin() + first, table.sizes.end());
+	std::vector<unsigned> bitrates(sizes.size());
+	unsigned nPadded = 0;
+	size_t padding = 0;
+	for(size_t i = 0; i < sizes.size(); ++i)
+	{
+		// A free format frame has the bitrate of its size
+		FrameHeader frame;
+		FrameHeader::parse(data + table.offsets[first + i], frame);
+		bitrates[i] = frame.bitrate;
+		if(frame.isFreeFormat())
+			bitrates[i] = (static_cast<uint64_t>(sizes[i]) * 8 * frame.samplingRate / frame.samples + 500) / 1000;
+		if(frame.padding)
+		{
+			++nPadded;
+			padding += frame.slotSize();
+		}
+	}
+
+	size_t bytes = 0;
+	unsigned minSize = sizes[0], maxSize = sizes[0];
+	for(auto size : sizes)
+	{
+		bytes += size;
+		minSize = std::min(minSize, size);
+		maxSize = std::max(maxSize, size);
+	}
+	unsigned minBitrate = bitrates[0], maxBitrate = bitrates[0];
+	for(auto bitrate : bitrates)
+	{
+		minBitrate = std::min(minBitrate, bitrate);
+		maxBitrate = std::max(maxBitrate, bitrate);
+	}
+
+	std::map<unsigned, unsigned> histogram;
+	for(auto bitrate : bitrates)
+		++histogram[bitrate];
+
+	// Frames are assigned to windows by their start time
+	uint64_t windowSamples = static_cast<uint64_t>(header.samplingRate) * s_statsWindowSeconds;
+	std::vector<size_t> windows((sizes.size() * header.samples + windowSamples - 1) / windowSamples, 0);
+	for(size_t i = 0; i < sizes.size(); ++i)
+		windows[i * header.samples / windowSamples] += sizes[i];
+
+	double duration = static_cast<double>(sizes.size()) * header.samples / header.samplingRate;
+	os << ",\"duration\":" << duration << ",\"bytes\":" << bytes;
+	os << ",\"bitrate\":{\"min\":" << minBitrate << ",\"max\":" << maxBitrate <<
+		  ",\"avg\":" << bytes * 8 / duration / 1000 << '}';
+
+	os << ",\"histogram\":{";
+	for(auto it = histogram.begin(); it != histogram.end(); ++it)
+		os << ((it == histogram.begin()) ? "" : ",") << '"' << it->first << "\":" << it->second;
+	os << '}';
+
+	os << ",\"frameSize\":{\"min\":" << minSize << ",\"max\":" << maxSize <<
+		  ",\"p50\":" << getPercentile(sizes, 50) << ",\"p90\":" << getPercentile(sizes, 90) <<
+		  ",\"p99\":" << getPercentile(sizes, 99) << '}';
+
+	os << ",\"window\":" << s_statsWindowSeconds << ",\"bytesPerWindow\":[";
+	for(size_t i = 0; i < windows.size(); ++i)
+		os << (i ? "," : "") << windows[i];
+	os << ']';
+
+	os << ",\"paddedFrames\":" << nPadded << ",\"paddingBytes\":" << padding << ",\"junkBytes\":" << junk << '}';
+	return os.str();
+}
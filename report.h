@@ -0,0 +1,24 @@
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+
+// Length of the windows of the frame statistics
+static const unsigned s_statsWindowSeconds = 1;
+
+
+// Check the integrity of the f_file loaded with the ID3v2 and MPEG parts:
+// the tags, lost sync, junk, a truncated final frame, CRCs of the Layer III
+// frames and the Xing header counts. The location of every issue is appended
+// to the f_outIssues. The CRCs are checked in parallel if f_parallel is set.
+// Return false if the file can't be read
+bool	verifyFile	(const LoadedFile& f_file, bool f_parallel, unsigned& f_outFrames, std::vector<std::string>& f_outIssues);
+
+// One JSON line of the frame statistics of the f_file loaded with the MPEG
+// part: the bitrate range and histogram, frame size percentiles, bytes per
+// window, padding and junk bytes
+std::string	getFrameStats	(const LoadedFile& f_file);
@@ -0,0 +1,123 @@
+#include "seekindex.h"
+
+#include "layout.h"
+#include "frames.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+
+static const char		s_magic[4]	= {'M', 'P', '3', 'S'};
+static const unsigned	s_version	= 1;
+
+
+static void putLE(std::vector<unsigned char>& f_out, uint64_t f_value, unsigned f_bytes)
+{
+	for(unsigned i = 0; i < f_bytes; ++i)
+		f_out.push_back((f_value >> (8 * i)) & 0xFF);
+}
+
+static uint64_t getLE(const unsigned char* f_data, unsigned f_bytes)
+{
+	uint64_t value = 0;
+	for(unsigned i = 0; i < f_bytes; ++i)
+		value |= static_cast<uint64_t>(f_data[i]) << (8 * i);
+	return value;
+}
+
+
+std::string SeekIndex::getPath(const std::string& f_path)
+{
+	return f_path + ".seek";
+}
+
+
+std::vector<unsigned char> SeekIndex::build(const unsigned char* f_data, size_t f_size, unsigned f_intervalMs)
+{
+	auto layout = Layout::probe(f_data, f_size);
+	auto data = f_data + layout.mpegOffset;
+	auto table = FrameTable::walk(data, layout.mpegSize);
+	unsigned nFrames = table.getFrameCount();
+
+	XingHeader xing;
+	unsigned first = (nFrames && XingHeader::parse(data + table.offsets[0], table.sizes[0], xing)) ? 1 : 0;
+	FrameHeader header;
+	if((first == nFrames) || !FrameHeader::parse(data + table.offsets[first], header))
+		throw std::runtime_error("no audio frames");
+
+	uint64_t interval = std::max<uint64_t>(1, static_cast<uint64_t>(f_intervalMs) * header.samplingRate / 1000);
+
+	std::vector<unsigned char> index;
+	index.insert(index.end(), s_magic, s_magic + sizeof(s_magic));
+	putLE(index, s_version, 4);
+	putLE(index, header.samplingRate, 4);
+	putLE(index, interval, 4);
+	putLE(index, f_size, 8);
+	auto countOffset = index.size();
+	putLE(index, 0, 8);
+
+	// Frames of a stream have the same number of samples
+	uint64_t count = 0;
+	uint64_t next = 0;
+	for(auto i = first; i < nFrames; ++i)
+	{
+		uint64_t sample = static_cast<uint64_t>(i - first) * header.samples;
+		uint64_t end = sample + header.samples;
+		if(end <= next)
+			continue;
+
+		putLE(index, sample, 8);
+		putLE(index, layout.mpegOffset + table.offsets[i], 8);
+		++count;
+		next = ((end - 1) / interval + 1) * interval;
+	}
+
+	for(unsigned i = 0; i < 8; ++i)
+		index[countOffset + i] = (count >> (8 * i)) & 0xFF;
+	return index;
+}
+
+// ====================================
+SeekIndex::SeekIndex(const std::string& f_path):
+	m_file(f_path)
+{
+	auto data = m_file.data();
+	if((m_file.size() < headerSize) || memcmp(data, s_magic, sizeof(s_magic)) || (getLE(data + 4, 4) != s_version))
+		throw std::runtime_error("\"" + f_path + "\" is not a seek index");
+
+	m_samplingRate	= getLE(data + 8, 4);
+	m_fileSize		= getLE(data + 16, 8);
+	m_count			= getLE(data + 24, 8);
+	if(m_count > (m_file.size() - headerSize) / entrySize)
+		throw std::runtime_error("the seek index \"" + f_path + "\" is truncated");
+}
+
+
+SeekIndex::Entry SeekIndex::getEntry(uint64_t f_index) const
+{
+	auto p = m_file.data() + headerSize + f_index * entrySize;
+	return {getLE(p, 8), getLE(p + 8, 8)};
+}
+
+
+bool SeekIndex::lookup(uint64_t f_sample, Entry& f_outEntry) const
+{
+	if(!m_count)
+		return false;
+
+	// The first entry after the f_sample
+	uint64_t lo = 0;
+	uint64_t hi = m_count;
+	while(lo < hi)
+	{
+		auto mid = lo + (hi - lo) / 2;
+		if(getEntry(mid).sample <= f_sample)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	f_outEntry = getEntry(lo ? lo - 1 : 0);
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "file.h"
+
+
+// Seek index sidecar: time to byte offset entries of an MP3 file at a fixed
+// interval for HTTP Range requests. The format is little endian:
+//   "MP3S", version, sampling rate, interval in samples (4 bytes each),
+//   the MP3 file size and the number of entries (8 bytes each),
+//   entries of a sample and an absolute file offset (8 bytes each).
+// An entry is the audio frame containing a multiple of the interval.
+// Samples count from the first audio frame after the Xing frame. The encoder
+// delay is not subtracted.
+class SeekIndex final
+{
+public:
+	struct Entry
+	{
+		uint64_t	sample;
+		uint64_t	offset;
+	};
+
+	static const unsigned	headerSize	= 32;
+	static const unsigned	entrySize	= 16;
+
+	// The sidecar file name of the f_path
+	static std::string	getPath	(const std::string& f_path);
+
+	// Build the index of the whole MP3 file data.
+	// Throws std::runtime_error if there are no audio frames
+	static std::vector<unsigned char>	build	(const unsigned char* f_data, size_t f_size, unsigned f_intervalMs);
+
+	// Map an index file. Throws std::runtime_error
+	explicit SeekIndex(const std::string& f_path);
+
+	unsigned	getSamplingRate	() const { return m_samplingRate; }
+	uint64_t	getFileSize		() const { return m_fileSize; }
+	uint64_t	getCount		() const { return m_count; }
+	Entry		getEntry		(uint64_t f_index) const;
+
+	// The last entry at or before the f_sample: a binary search over the
+	// mapped entries. Return false if the index is empty
+	bool		lookup			(uint64_t f_sample, Entry& f_outEntry) const;
+
+private:
+	MappedFile	m_file;
+	unsigned	m_samplingRate;
+	uint64_t	m_fileSize;
+	uint64_t	m_count;
+};
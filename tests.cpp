@@ -0,0 +1,1264 @@
+// Behavior tests of the code which doesn't need the MPEG library, built and
+// run with "make test". Test names may be passed to run only those, e.g.
+// "./mp3_test id3v2". Temporary files are created in the $TMPDIR or /tmp
+#include "aio.h"
+#include "batch.h"
+#include "edit.h"
+#include "id3v2.h"
+#include "file.h"
+#include "frames.h"
+#include "hash.h"
+#include "layout.h"
+#include "report.h"
+#include "seekindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+static unsigned s_failures = 0;
+
+#define CHECK(X)	do { if(!(X)) { fprintf(stderr, "CHECK failed: %s @ %s:%d\n", #X, __FILE__, __LINE__); ++s_failures; } } while(0)
+
+#define CHECK_THROWS(X, E)	do { bool bThrown = false; try { X; } catch(const E&) { bThrown = true; } CHECK(bThrown && #E); } while(0)
+
+
+using Bytes = std::vector<unsigned char>;
+
+
+// A file which is removed at the end of the test
+class TempFile final
+{
+public:
+	explicit TempFile(const Bytes& f_contents)
+	{
+		auto dir = getenv("TMPDIR");
+		m_path = std::string((dir && *dir) ? dir : "/tmp") + "/mp3_test_XXXXXX";
+		auto fd = mkstemp(&m_path[0]);
+		if(fd < 0)
+			throw std::runtime_error("failed to create a temporary file");
+		bool bWritten = (write(fd, f_contents.data(), f_contents.size()) == static_cast<ssize_t>(f_contents.size()));
+		close(fd);
+		if(!bWritten)
+			throw std::runtime_error("failed to write a temporary file");
+	}
+	~TempFile() { unlink(m_path.c_str()); }
+
+	TempFile(const TempFile&) = delete;
+	TempFile& operator=(const TempFile&) = delete;
+
+	const std::string&	path() const { return m_path; }
+
+	Bytes read() const
+	{
+		MappedFile file(m_path);
+		return Bytes(file.data(), file.data() + file.size());
+	}
+
+private:
+	std::string	m_path;
+};
+
+
+static void append(Bytes& f_ioBytes, const std::string& f_string)
+{
+	f_ioBytes.insert(f_ioBytes.end(), f_string.begin(), f_string.end());
+}
+
+// ====================================
+// ID3v2.3 frame with a 32-bit size
+static void appendFrame(Bytes& f_ioTag, const char* f_id, const Bytes& f_payload)
+{
+	append(f_ioTag, f_id);
+	auto n = f_payload.size();
+	f_ioTag.insert(f_ioTag.end(), {static_cast<unsigned char>(n >> 24), static_cast<unsigned char>(n >> 16),
+								   static_cast<unsigned char>(n >> 8), static_cast<unsigned char>(n), 0, 0});
+	f_ioTag.insert(f_ioTag.end(), f_payload.begin(), f_payload.end());
+}
+
+
+// ID3v2.3 tag with a title, an iTunes comment and the f_padding
+static Bytes makeID3v2(size_t f_padding)
+{
+	Bytes frames;
+	Bytes title = {0};
+	append(title, "Title");
+	appendFrame(frames, "TIT2", title);
+	Bytes comment = {0};
+	append(comment, "deu");
+	append(comment, "iTunNORM");
+	comment.push_back(0);
+	append(comment, " 00000001");
+	appendFrame(frames, "COMM", comment);
+	frames.resize(frames.size() + f_padding, 0);
+
+	auto n = frames.size();
+	Bytes tag = {'I', 'D', '3', 3, 0, 0,
+				 static_cast<unsigned char>((n >> 21) & 0x7F), static_cast<unsigned char>((n >> 14) & 0x7F),
+				 static_cast<unsigned char>((n >> 7) & 0x7F), static_cast<unsigned char>(n & 0x7F)};
+	tag.insert(tag.end(), frames.begin(), frames.end());
+	return tag;
+}
+
+
+// Frames of the f_frameSize with the f_header and zero data
+static void appendFrames(Bytes& f_ioStream, const Bytes& f_header, size_t f_frameSize, unsigned f_count)
+{
+	for(unsigned i = 0; i < f_count; ++i)
+	{
+		f_ioStream.insert(f_ioStream.end(), f_header.begin(), f_header.end());
+		f_ioStream.resize(f_ioStream.size() + f_frameSize - f_header.size(), 0);
+	}
+}
+
+
+static void testID3v2()
+{
+	auto source = makeID3v2(64);
+	CHECK(LazyID3v2::getSize(source.data(), source.size()) == source.size());
+
+	auto tag = LazyID3v2::create(source.data(), source.size());
+	CHECK(tag && !tag->hasIssues());
+	CHECK(tag->getPaddingSize() == 64);
+	CHECK(tag->getText("TIT2", 0) == "Title");
+
+	// An unmodified tag is copied as is
+	Bytes raw;
+	tag->serialize(raw);
+	CHECK(raw == source);
+
+	// The comment with a description is kept, a new one is added
+	tag->setText("TIT2", "New title");
+	tag->setText("COMM", "Comment");
+	CHECK(tag->isModified());
+	CHECK(tag->getTextCount("COMM") == 2);
+	CHECK(tag->getRequiredSize() <= source.size());
+
+	Bytes serialized;
+	tag->serialize(serialized, source.size());
+	CHECK(serialized.size() == source.size());
+	auto copy = LazyID3v2::create(serialized.data(), serialized.size());
+	CHECK(copy && !copy->hasIssues());
+	CHECK(copy->getSize() == source.size());
+	CHECK(copy->getText("TIT2", 0) == "New title");
+	CHECK(copy->getTextCount("COMM") == 2);
+	CHECK(copy->getText("COMM", 0) == " 00000001");
+	CHECK(copy->getText("COMM", 1) == "Comment");
+
+	// Editing the comment again replaces the one without a description
+	copy->setText("COMM", "Other");
+	CHECK(copy->getTextCount("COMM") == 2);
+	CHECK(copy->getText("COMM", 1) == "Other");
+
+	// Removal
+	copy->setText("TIT2", "");
+	CHECK(!copy->getTextCount("TIT2"));
+
+	// Sizes which don't fit the size fields or the frames
+	Bytes out;
+	CHECK_THROWS(tag->serialize(out, tag->getRequiredSize() - 1), std::length_error);
+	CHECK_THROWS(tag->serialize(out, 0x0FFFFFFF + 11), std::length_error);
+	CHECK(out.empty());
+
+	// An ID3v2.3 extended header is skipped, one past the tag is an issue
+	auto extended = source;
+	extended[5] = 0x40;
+	Bytes header = {0, 0, 0, 6, 0, 0, 0, 0, 0, 0};
+	extended.insert(extended.begin() + 10, header.begin(), header.end());
+	extended[9] += header.size();
+	auto withHeader = LazyID3v2::create(extended.data(), extended.size());
+	CHECK(withHeader && !withHeader->hasIssues() && (withHeader->getText("TIT2", 0) == "Title"));
+	extended[12] = 0x7F;
+	withHeader = LazyID3v2::create(extended.data(), extended.size());
+	CHECK(withHeader && withHeader->hasIssues() && !withHeader->getTextCount("TIT2"));
+}
+
+
+static void testPatchFile()
+{
+	Bytes contents(1000);
+	for(size_t i = 0; i < contents.size(); ++i)
+		contents[i] = i & 0xFF;
+	TempFile file(contents);
+
+	Bytes head = {'I', 'D', '3'};
+	Bytes tail(10, 0xAA);
+	patchFile(file.path(), {{0, {head.data(), head.size()}}, {990, {tail.data(), tail.size()}}});
+
+	std::copy(head.begin(), head.end(), contents.begin());
+	std::copy(tail.begin(), tail.end(), contents.begin() + 990);
+	CHECK(file.read() == contents);
+}
+
+
+// Names in the directory of the f_path which start with its name
+static std::vector<std::string> findSiblings(const std::string& f_path)
+{
+	auto slash = f_path.rfind('/');
+	auto dirPath = f_path.substr(0, slash);
+	auto name = f_path.substr(slash + 1);
+
+	std::vector<std::string> names;
+	auto dir = opendir(dirPath.c_str());
+	if(!dir)
+		return names;
+	while(auto entry = readdir(dir))
+	{
+		if(!strncmp(entry->d_name, name.c_str(), name.size()))
+			names.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+
+static void testWriteFileAtomic()
+{
+	TempFile file({1, 2, 3});
+	chmod(file.path().c_str(), 0640);
+	auto name = file.path().substr(file.path().rfind('/') + 1);
+
+	// A file of the name of a temporary file is left alone
+	Bytes user = {'u', 's', 'e', 'r'};
+	auto pathUser = file.path() + ".tmp";
+	FILE* f = fopen(pathUser.c_str(), "wb");
+	CHECK(f && (fwrite(user.data(), 1, user.size(), f) == user.size()));
+	if(f)
+		fclose(f);
+
+	Bytes head = {4, 5};
+	Bytes tail = {6};
+	writeFileAtomic(file.path(), {{head.data(), head.size()}, {nullptr, 0}, {tail.data(), tail.size()}});
+	CHECK(file.read() == Bytes({4, 5, 6}));
+	struct stat st;
+	CHECK(!stat(file.path().c_str(), &st) && ((st.st_mode & 07777) == 0640));
+	CHECK(MappedFile(pathUser).size() == user.size());
+	CHECK(findSiblings(file.path()) == std::vector<std::string>({name, name + ".tmp"}));
+	unlink(pathUser.c_str());
+
+	// A new file has the permissions of a created one
+	auto pathNew = file.path() + ".new";
+	writeFileAtomic(pathNew, {{head.data(), head.size()}});
+	auto mask = umask(0);
+	umask(mask);
+	CHECK(!stat(pathNew.c_str(), &st) && ((st.st_mode & 07777) == (0644 & ~mask)) && (st.st_size == 2));
+	unlink(pathNew.c_str());
+}
+
+
+// The size of an ID3v2 tag which runs past the end of the file is unknown,
+// so the tag is never patched in place
+static void testID3v2Overrun()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	auto file = makeID3v2(64);
+	auto tagSize = file.size();
+	appendFrames(file, header, 417, 3);
+	Bytes id3v1 = {'T', 'A', 'G'};
+	id3v1.resize(128, 0);
+	file.insert(file.end(), id3v1.begin(), id3v1.end());
+
+	auto layout = Layout::probe(file.data(), file.size());
+	CHECK(!layout.hasIssues() && (layout.id3v2Size == tagSize) && (layout.id3v1Size == 128));
+	CHECK(layout.canPatchID3v2(tagSize) && !layout.canPatchID3v2(tagSize + 1));
+
+	// The tag claims the audio and the ID3v1 tag
+	file[8] = 0x7F;
+	layout = Layout::probe(file.data(), file.size());
+	CHECK(layout.id3v2Overrun && (layout.id3v2Size == file.size()));
+	CHECK(!layout.mpegSize && !layout.id3v1Size);
+	CHECK(!layout.canPatchID3v2(tagSize));
+}
+
+
+// APEv2 tag with the f_itemsSize bytes of items and an optional header
+static Bytes makeAPE(size_t f_itemsSize, bool f_header)
+{
+	auto size = f_itemsSize + 32;
+	Bytes footer = {'A', 'P', 'E', 'T', 'A', 'G', 'E', 'X', 0xD0, 0x07, 0, 0,
+					static_cast<unsigned char>(size), static_cast<unsigned char>(size >> 8),
+					static_cast<unsigned char>(size >> 16), static_cast<unsigned char>(size >> 24),
+					1, 0, 0, 0, 0, 0, 0, static_cast<unsigned char>(f_header ? 0xA0 : 0x80)};
+	footer.resize(32, 0);
+
+	Bytes tag;
+	if(f_header)
+		tag = footer;
+	tag.resize(tag.size() + f_itemsSize, 'a');
+	tag.insert(tag.end(), footer.begin(), footer.end());
+	return tag;
+}
+
+
+// Lyrics3v2 tag with the f_lyricsSize bytes of lyrics
+static Bytes makeLyrics3(size_t f_lyricsSize)
+{
+	Bytes tag;
+	append(tag, "LYRICSBEGIN");
+	tag.resize(tag.size() + f_lyricsSize, 'l');
+	char size[8];
+	snprintf(size, sizeof(size), "%06zu", tag.size());
+	append(tag, size);
+	append(tag, "LYRICS200");
+	return tag;
+}
+
+
+static void testProbeTrailer()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	Bytes id3v1 = {'T', 'A', 'G'};
+	id3v1.resize(128, 0);
+	const std::vector<Bytes> tags = {makeAPE(5000, true), makeLyrics3(3000), id3v1};
+
+	// Every order of the tags, probed from a tail which is extended by the
+	// missing bytes until it covers all of them
+	std::vector<size_t> order = {0, 1, 2};
+	do
+	{
+		auto file = makeID3v2(20);
+		auto mpegOffset = file.size();
+		appendFrames(file, header, 417, 4);
+		auto trailerOffset = file.size();
+		for(auto i : order)
+			file.insert(file.end(), tags[i].begin(), tags[i].end());
+
+		Layout layout;
+		layout.fileSize = file.size();
+		layout.probeHead(file.data(), 1024);
+		size_t tailSize = 16;
+		size_t needed = 0;
+		unsigned nRetries = 0;
+		while(!layout.probeTrailer(&file[file.size() - tailSize], tailSize, needed) && (nRetries < 8))
+		{
+			CHECK((needed > tailSize) && (needed <= file.size() - trailerOffset + 128));
+			tailSize = needed;
+			++nRetries;
+		}
+		CHECK(nRetries && (nRetries < 8));
+		CHECK(!layout.hasIssues() && (layout.mpegOffset == mpegOffset) && (layout.trailerOffset() == trailerOffset));
+
+		size_t offsets[3];
+		size_t offset = trailerOffset;
+		for(auto i : order)
+		{
+			offsets[i] = offset;
+			offset += tags[i].size();
+		}
+		CHECK((layout.apeOffset == offsets[0]) && (layout.apeSize == tags[0].size()));
+		CHECK((layout.lyricsOffset == offsets[1]) && (layout.lyricsSize == tags[1].size()));
+		CHECK((layout.id3v1Offset == offsets[2]) && (layout.id3v1Size == 128));
+
+		// The same layout as from the whole file
+		auto whole = Layout::probe(file.data(), file.size());
+		CHECK((whole.mpegSize == layout.mpegSize) && (whole.apeOffset == layout.apeOffset) &&
+			  (whole.lyricsOffset == layout.lyricsOffset) && (whole.id3v1Offset == layout.id3v1Offset));
+	}
+	while(std::next_permutation(order.begin(), order.end()));
+
+	// A Lyrics3v2 size beyond the file is an issue
+	auto file = makeID3v2(0);
+	appendFrames(file, header, 417, 1);
+	auto lyrics = makeLyrics3(10);
+	memcpy(&lyrics[lyrics.size() - 15], "999999", 6);
+	file.insert(file.end(), lyrics.begin(), lyrics.end());
+	auto layout = Layout::probe(file.data(), file.size());
+	CHECK(layout.trailerIssues && !layout.lyricsSize);
+}
+
+// ====================================
+// Big endian bit fields as in the side information
+class BitWriter
+{
+public:
+	explicit BitWriter(unsigned char* f_data):
+		m_data(f_data),
+		m_pos(0)
+	{}
+
+	void write(unsigned f_value, unsigned f_bits)
+	{
+		for(unsigned i = f_bits; i--; ++m_pos)
+		{
+			if((f_value >> i) & 1)
+				m_data[m_pos / 8] |= 0x80 >> (m_pos % 8);
+		}
+	}
+
+	void skip(unsigned f_bits) { m_pos += f_bits; }
+
+private:
+	unsigned char*	m_data;
+	unsigned		m_pos;
+};
+
+
+// Zero frame of the f_header with the side information fields of the f_info
+static Bytes makeLayer3Frame(const Bytes& f_header, const SideInfo& f_info)
+{
+	FrameHeader header;
+	if(!FrameHeader::parse(f_header.data(), header))
+		throw std::logic_error("invalid test frame header");
+
+	Bytes frame(header.size, 0);
+	std::copy(f_header.begin(), f_header.end(), frame.begin());
+
+	bool bV1 = (header.version == MPEG::Version::v1);
+	BitWriter bits(frame.data() + header.dataOffset());
+	bits.write(f_info.mainDataBegin, bV1 ? 9 : 8);
+	bits.skip(bV1 ? ((f_info.channels == 1) ? 5 : 3) + 4 * f_info.channels : f_info.channels);
+	for(unsigned gr = 0; gr < f_info.granules; ++gr)
+	{
+		for(unsigned ch = 0; ch < f_info.channels; ++ch)
+		{
+			auto& granule = f_info.granule[gr][ch];
+			bits.write(granule.part23Length, 12);
+			bits.write(granule.bigValues, 9);
+			bits.write(granule.globalGain, 8);
+			bits.skip(bV1 ? (4 + 1 + 22 + 3) : (9 + 1 + 22 + 2));
+		}
+	}
+	return frame;
+}
+
+
+static void testSideInfo()
+{
+	// MPEG-1 stereo with a CRC, 128 kbps, 44.1 kHz
+	SideInfo info = {};
+	info.mainDataBegin	= 300;
+	info.granules		= 2;
+	info.channels		= 2;
+	for(unsigned gr = 0; gr < 2; ++gr)
+	{
+		for(unsigned ch = 0; ch < 2; ++ch)
+			info.granule[gr][ch] = {1000u + 100 * (2 * gr + ch), 10 + gr, 140 + ch};
+	}
+	auto frame = makeLayer3Frame({0xFF, 0xFA, 0x90, 0x00}, info);
+
+	FrameHeader header;
+	SideInfo parsed;
+	CHECK(FrameHeader::parse(frame.data(), header));
+	CHECK(header.protection && (header.sideInfoSize() == 32));
+	CHECK(SideInfo::parse(frame.data(), frame.size(), header, parsed));
+	CHECK((parsed.mainDataBegin == 300) && (parsed.granules == 2) && (parsed.channels == 2));
+	for(unsigned gr = 0; gr < 2; ++gr)
+	{
+		for(unsigned ch = 0; ch < 2; ++ch)
+		{
+			auto& granule = parsed.granule[gr][ch];
+			CHECK(granule.part23Length == 1000u + 100 * (2 * gr + ch));
+			CHECK((granule.bigValues == 10 + gr) && (granule.globalGain == 140 + ch));
+		}
+	}
+	CHECK(parsed.mainDataSize() == (1000 + 1100 + 1200 + 1300 + 7) / 8);
+	CHECK(!parsed.isSilent(150));
+
+	// Too short for the side information, not Layer III
+	CHECK(!SideInfo::parse(frame.data(), header.dataOffset() + 31, header, parsed));
+	FrameHeader layer2;
+	const unsigned char layer2Header[] = {0xFF, 0xFD, 0x90, 0x00};
+	CHECK(FrameHeader::parse(layer2Header, layer2) && !SideInfo::parse(frame.data(), frame.size(), layer2, parsed));
+
+	// MPEG-2 mono has one granule and an 8-bit main_data_begin
+	info = {};
+	info.mainDataBegin	= 200;
+	info.granules		= 1;
+	info.channels		= 1;
+	info.granule[0][0]	= {12, 0, 100};
+	frame = makeLayer3Frame({0xFF, 0xF3, 0x80, 0xC0}, info);
+	CHECK(FrameHeader::parse(frame.data(), header));
+	CHECK(!header.protection && (header.sideInfoSize() == 9) && (header.samples == 576));
+	CHECK(SideInfo::parse(frame.data(), frame.size(), header, parsed));
+	CHECK((parsed.mainDataBegin == 200) && (parsed.granules == 1) && (parsed.channels == 1));
+	CHECK((parsed.granule[0][0].part23Length == 12) && (parsed.granule[0][0].globalGain == 100));
+	CHECK(parsed.mainDataSize() == 2);
+
+	// Only quiet +-1 values or empty granules are silence
+	CHECK(parsed.isSilent(150) && !parsed.isSilent(99));
+	parsed.granule[0][0].bigValues = 1;
+	CHECK(!parsed.isSilent(150));
+	parsed.granule[0][0].part23Length = 0;
+	CHECK(parsed.isSilent(0));
+}
+
+// ====================================
+// MPEG-1 Layer III 128 kbit/s stereo frames with 381 bytes of main data each.
+// The frame 6 refers to 500 bytes of the frames 4 and 5
+static Bytes makeReservoirStream(FrameTable& f_outTable)
+{
+	SideInfo info = {};
+	info.granules	= 2;
+	info.channels	= 2;
+	for(auto& granule : info.granule)
+		granule[0] = granule[1] = {100, 10, 200};
+
+	Bytes stream;
+	for(unsigned i = 0; i < 10; ++i)
+	{
+		info.mainDataBegin = (i == 6) ? 500 : 0;
+		auto frame = makeLayer3Frame({0xFF, 0xFB, 0x90, 0x00}, info);
+		// Main data which tells the frames apart
+		std::fill(frame.begin() + 36, frame.end(), i + 1);
+		stream.insert(stream.end(), frame.begin(), frame.end());
+	}
+	f_outTable = FrameTable::walk(stream.data(), stream.size());
+	return stream;
+}
+
+
+static void testReservoirBridge()
+{
+	FrameTable table;
+	auto input = makeReservoirStream(table);
+	CHECK(table.getFrameCount() == 10);
+	CHECK((table.getReservoirFrames(input.data(), 6, 0) == 2) && (table.getReservoirFrames(input.data(), 6, 5) == 1));
+	CHECK(!table.getReservoirFrames(input.data(), 5, 0));
+
+	// Cutting out the frames 3 to 5 removes the frame 3 only
+	ReservoirBridge bridge;
+	CHECK(bridgeReservoir(input.data(), table, 3, 3, bridge) == 1);
+	CHECK((bridge.count == 2) && (bridge.source == 4) && (bridge.output == 3) && (bridge.bytes == 500));
+
+	auto output = input;
+	output.erase(output.begin() + table.offsets[3], output.begin() + table.offsets[4]);
+	applyReservoirBridge(output, bridge, input.data(), table);
+	auto out = FrameTable::walk(output.data(), output.size());
+	CHECK(out.getFrameCount() == 9);
+	for(unsigned i = 0; i < out.getFrameCount(); ++i)
+	{
+		auto frame = &output[out.offsets[i]];
+		FrameHeader header;
+		SideInfo info;
+		CHECK(FrameHeader::parse(frame, header) && SideInfo::parse(frame, out.sizes[i], header, info));
+
+		// The bridging frames keep their main data but decode to nothing
+		bool bBridge = (i == 3) || (i == 4);
+		CHECK(bBridge ? !info.mainDataSize() && !info.mainDataBegin : (info.mainDataSize() == 50));
+		CHECK(frame[36] == ((i < 3) ? i + 1 : i + 2));
+	}
+	CHECK(out.getReservoirFrames(output.data(), 5, 0) == 2);
+
+	// The frame after the cut needs all the frames of the range
+	ReservoirBridge whole;
+	CHECK(!bridgeReservoir(input.data(), table, 5, 1, whole) && (whole.count == 1));
+	// No frame after the cut
+	ReservoirBridge none;
+	CHECK((bridgeReservoir(input.data(), table, 8, 2, none) == 2) && !none.count);
+
+	// The output doesn't hold the bridging frames
+	CHECK_THROWS(applyReservoirBridge(input, {4, 5, 2, 500}, input.data(), table), std::runtime_error);
+}
+
+
+// Sum of the copied or the synthesized bytes of the f_pieces
+static size_t getPlanBytes(const std::vector<OutputPiece>& f_pieces, bool f_copied)
+{
+	size_t n = 0;
+	for(auto& piece : f_pieces)
+		n += (piece.bCopied == f_copied) ? piece.bytes.size : 0;
+	return n;
+}
+
+
+static bool hasText(const std::string& f_string, const std::string& f_text)
+{
+	return f_string.find(f_text) != std::string::npos;
+}
+
+
+static void testPlanOutput()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	static const size_t s_frameSize = 417;
+	static const unsigned s_nFrames = 5;
+
+	// Info frame and the audio frames which differ from each other
+	auto file = makeID3v2(10);
+	auto tagSize = file.size();
+	auto xingFrame = makeXingFrame(header.data(), false);
+	auto xingSize = xingFrame.size();
+	file.insert(file.end(), xingFrame.begin(), xingFrame.end());
+	auto audioOffset = file.size();
+	appendFrames(file, header, s_frameSize, s_nFrames);
+	for(unsigned i = 0; i < s_nFrames; ++i)
+		file[audioOffset + i * s_frameSize + 36] = i + 1;
+	Bytes id3v1 = {'T', 'A', 'G'};
+	id3v1.resize(128, 0);
+	file.insert(file.end(), id3v1.begin(), id3v1.end());
+
+	auto layout = Layout::probe(file.data(), file.size());
+	CHECK(!layout.hasIssues() && (layout.mpegOffset == tagSize) && (layout.id3v1Size == 128));
+	auto getFrames = [&](std::initializer_list<unsigned> f_frames)
+	{
+		Bytes stream;
+		for(auto i : f_frames)
+			stream.insert(stream.end(), &file[audioOffset + i * s_frameSize], &file[audioOffset + (i + 1) * s_frameSize]);
+		return stream;
+	};
+
+	// Only the Info frame changes, e.g. a cut within the encoder delay. The
+	// adjacent runs of the input are merged
+	auto head = xingFrame;
+	head[xingSize - 1] = 1;
+	auto stream = getFrames({0, 1, 2, 3, 4});
+	auto pieces = planOutput(file.data(), layout, {head.data(), head.size()}, stream);
+	CHECK(pieces.size() == 3);
+	CHECK(pieces[1].offset == tagSize && !pieces[1].bCopied && (pieces[1].bytes.size == xingSize));
+	CHECK(pieces[2].bCopied && (pieces[2].source == audioOffset) && (pieces[2].bytes.size == file.size() - audioOffset));
+	CHECK(getPlanBytes(pieces, true) == file.size() - xingSize);
+	CHECK(getPlanBytes(pieces, false) == xingSize);
+	CHECK(isInPlace(pieces, file.data(), layout));
+
+	auto plan = formatPlan("in.mp3", "in.mp3", file.size(), pieces, true);
+	CHECK(hasText(plan, "\"inputSize\":" + std::to_string(file.size()) + ",\"outputSize\":" + std::to_string(file.size())));
+	CHECK(hasText(plan, "\"bytesCopied\":" + std::to_string(file.size() - xingSize)));
+	CHECK(hasText(plan, "\"bytesSynthesized\":" + std::to_string(xingSize)));
+	CHECK(hasText(plan, "\"inPlace\":true,\"bytesWritten\":" + std::to_string(xingSize) + ','));
+
+	// A cut frame moves the frames after it and the tags
+	stream = getFrames({0, 1, 3, 4});
+	pieces = planOutput(file.data(), layout, {head.data(), head.size()}, stream);
+	CHECK(pieces.size() == 4);
+	CHECK(pieces[3].bCopied && (pieces[3].source == audioOffset + 3 * s_frameSize) && (pieces[3].offset == audioOffset + 2 * s_frameSize));
+	CHECK(pieces[3].bytes.size == 2 * s_frameSize + 128);
+	CHECK(getPlanBytes(pieces, true) == file.size() - xingSize - s_frameSize);
+	CHECK(!isInPlace(pieces, file.data(), layout));
+
+	auto outSize = file.size() - s_frameSize;
+	plan = formatPlan("in.mp3", "out.mp3", file.size(), pieces, false);
+	CHECK(hasText(plan, "\"outputSize\":" + std::to_string(outSize)));
+	CHECK(hasText(plan, "\"inPlace\":false,\"bytesWritten\":" + std::to_string(outSize) + ','));
+
+	// A modified audio frame of the same size is rewritten with the whole file
+	stream = getFrames({0, 1, 2, 3, 4});
+	stream[3 * s_frameSize + 36] = 0xFF;
+	pieces = planOutput(file.data(), layout, {head.data(), head.size()}, stream);
+	CHECK(getPlanBytes(pieces, false) == xingSize + s_frameSize);
+	CHECK(getPlanBytes(pieces, true) + getPlanBytes(pieces, false) == file.size());
+	CHECK(!isInPlace(pieces, file.data(), layout));
+
+	// Reordered frames are found by their hash
+	stream = getFrames({4, 0});
+	pieces = planOutput(file.data(), layout, {nullptr, 0}, stream);
+	CHECK((pieces.size() == 4) && !getPlanBytes(pieces, false));
+	CHECK((pieces[1].source == audioOffset + 4 * s_frameSize) && (pieces[2].source == audioOffset));
+	CHECK(pieces[3].source == layout.trailerOffset());
+}
+
+// ====================================
+static void testLameTag()
+{
+	// MPEG-1 Layer III 128 kbit/s 44.1 kHz stereo
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	auto frame = makeXingFrame(header.data(), false);
+	CHECK(!frame.empty());
+
+	XingHeader xing;
+	LameTag tag;
+	CHECK(XingHeader::parse(frame.data(), frame.size(), xing));
+	CHECK((xing.offset == 36) && (xing.flags == (XingHeader::Flags::Frames | XingHeader::Flags::Bytes)));
+	CHECK(!memcmp(frame.data() + xing.offset, "Info", 4));
+	CHECK(LameTag::parse(frame.data(), frame.size(), xing, tag));
+	CHECK((tag.offset == xing.offset + 16) && !tag.delay && !tag.padding);
+	CHECK(!memcmp(frame.data() + tag.offset, "LAME", 4));
+
+	// The music CRC of "123456789" is the CRC-16/ARC check value
+	const std::string music = "123456789";
+	tag.delay		= 576;
+	tag.padding		= 1000;
+	tag.musicLength	= frame.size() + music.size();
+	tag.write(frame.data(), reinterpret_cast<const unsigned char*>(music.data()), music.size());
+
+	auto p = frame.data() + tag.offset;
+	CHECK((p[21] == 0x24) && (p[22] == 0x03) && (p[23] == 0xE8));
+	CHECK((p[28] == 0) && (p[29] == 0) && (p[30] == ((frame.size() + 9) >> 8)) && (p[31] == ((frame.size() + 9) & 0xFF)));
+	CHECK((p[32] == 0xBB) && (p[33] == 0x3D));
+
+	LameTag parsed;
+	CHECK(LameTag::parse(frame.data(), frame.size(), xing, parsed));
+	CHECK((parsed.delay == 576) && (parsed.padding == 1000) && (parsed.musicLength == tag.musicLength));
+
+	// A tag of an unknown encoder is only accepted with a valid tag CRC
+	memcpy(p, "ABCD", 4);
+	CHECK(!LameTag::parse(frame.data(), frame.size(), xing, parsed));
+	tag.write(frame.data(), reinterpret_cast<const unsigned char*>(music.data()), music.size());
+	CHECK(LameTag::parse(frame.data(), frame.size(), xing, parsed));
+	frame[tag.offset + 25] ^= 1;
+	CHECK(!LameTag::parse(frame.data(), frame.size(), xing, parsed));
+
+	// Only zero bytes are taken for a new tag
+	CHECK(!LameTag::create(frame.data(), frame.size(), xing, parsed));
+	memset(p, 0, LameTag::size);
+	CHECK(LameTag::create(frame.data(), frame.size(), xing, parsed) && (parsed.offset == tag.offset));
+	CHECK(!LameTag::create(frame.data(), tag.offset + LameTag::size - 1, xing, parsed));
+}
+
+
+static void testXing()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	static const size_t s_frameSize = 417;
+	static const unsigned s_nFrames = 40;
+
+	// Xing frame with every field followed by the audio frames
+	Bytes stream;
+	appendFrames(stream, header, s_frameSize, 1 + s_nFrames);
+	memcpy(&stream[36], "Xing", 4);
+	stream[43] = XingHeader::Flags::Frames | XingHeader::Flags::Bytes | XingHeader::Flags::TOC | XingHeader::Flags::Quality;
+
+	XingHeader xing;
+	CHECK(XingHeader::parse(stream.data(), s_frameSize, xing));
+	CHECK((xing.getSize() == 120) && !xing.frames && !xing.bytes);
+
+	auto music = FrameTable::walk(stream.data() + s_frameSize, stream.size() - s_frameSize);
+	CHECK(music.getFrameCount() == s_nFrames);
+	xing.frames	= s_nFrames;
+	xing.bytes	= stream.size();
+	xing.buildTOC(music, s_frameSize);
+	xing.write(stream.data());
+
+	// Each percent points at the byte position of its frame
+	XingHeader parsed;
+	CHECK(XingHeader::parse(stream.data(), s_frameSize, parsed));
+	CHECK((parsed.frames == s_nFrames) && (parsed.bytes == stream.size()));
+	for(unsigned i = 0; i < 100; ++i)
+		CHECK(parsed.toc[i] == (1 + i * s_nFrames / 100) * 256 / (1 + s_nFrames));
+	CHECK(!memcmp(parsed.toc, xing.toc, sizeof(xing.toc)));
+
+	// The fields which are not present are not written
+	memset(&stream[40], 0, 120);
+	stream[43] = XingHeader::Flags::Bytes;
+	CHECK(XingHeader::parse(stream.data(), s_frameSize, xing));
+	xing.frames	= s_nFrames;
+	xing.bytes	= stream.size();
+	xing.write(stream.data());
+	CHECK(XingHeader::parse(stream.data(), s_frameSize, parsed));
+	CHECK(!parsed.frames && (parsed.bytes == stream.size()) && !parsed.toc[99]);
+	CHECK(std::all_of(&stream[48], &stream[160], [](unsigned char f_byte) { return !f_byte; }));
+
+	// Truncated headers
+	CHECK(!XingHeader::parse(stream.data(), 36 + 8 + 3, parsed));
+	stream[36] = 'x';
+	CHECK(!XingHeader::parse(stream.data(), s_frameSize, parsed));
+}
+
+// ====================================
+static uint64_t hashString(const std::string& f_string)
+{
+	return Hash64::calc(reinterpret_cast<const unsigned char*>(f_string.data()), f_string.size());
+}
+
+
+static void testHash64()
+{
+	// Published XXH64 values with the seed 0
+	CHECK(hashString("") == 0xEF46DB3751D8E999ull);
+	CHECK(hashString("a") == 0xD24EC4F1A98C6E5Bull);
+	CHECK(hashString("abc") == 0x44BC2CF5AD770999ull);
+	CHECK(hashString("Nobody inspects the spammish repetition") == 0xFBCEA83C8A378BF1ull);
+
+	// Updates of any size give the digest of the whole input
+	Bytes data(1000);
+	for(size_t i = 0; i < data.size(); ++i)
+		data[i] = (i * 7) & 0xFF;
+	for(uint64_t seed : {0ull, 0x9E3779B97F4A7C15ull})
+	{
+		auto expected = Hash64::calc(data.data(), data.size(), seed);
+		for(size_t chunk : {1, 5, 31, 32, 33, 100})
+		{
+			Hash64 hash(seed);
+			for(size_t offset = 0; offset < data.size(); offset += chunk)
+				hash.update(data.data() + offset, std::min(chunk, data.size() - offset));
+			CHECK(hash.digest() == expected);
+		}
+	}
+	CHECK(Hash64::calc(data.data(), data.size(), 1) != Hash64::calc(data.data(), data.size()));
+}
+
+// ====================================
+static void testSeekIndex()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	static const size_t s_frameSize = 417;
+	static const unsigned s_nFrames = 100;
+
+	auto file = makeID3v2(10);
+	auto xingFrame = makeXingFrame(header.data(), false);
+	file.insert(file.end(), xingFrame.begin(), xingFrame.end());
+	auto firstOffset = file.size();
+	appendFrames(file, header, s_frameSize, s_nFrames);
+
+	// The frames containing each multiple of 100 ms, i.e. 4410 samples
+	TempFile index(SeekIndex::build(file.data(), file.size(), 100));
+	SeekIndex seek(index.path());
+	CHECK((seek.getSamplingRate() == 44100) && (seek.getFileSize() == file.size()));
+	CHECK(seek.getCount() == 1 + s_nFrames * 1152 / 4410);
+	for(uint64_t i = 0; i < seek.getCount(); ++i)
+	{
+		uint64_t frame = i * 4410 / 1152;
+		auto entry = seek.getEntry(i);
+		CHECK((entry.sample == frame * 1152) && (entry.offset == firstOffset + frame * s_frameSize));
+	}
+
+	// The last entry at or before the sample
+	SeekIndex::Entry entry;
+	for(uint64_t sample : {0, 3455, 3456, 4410, 60000, 10000000})
+	{
+		uint64_t last = 0;
+		while((last + 1 < seek.getCount()) && (seek.getEntry(last + 1).sample <= sample))
+			++last;
+		CHECK(seek.lookup(sample, entry) && (entry.sample == seek.getEntry(last).sample));
+	}
+	CHECK(seek.lookup(3456, entry) && (entry.sample == 3456));
+
+	// An index without entries
+	auto empty = index.read();
+	empty.resize(SeekIndex::headerSize);
+	std::fill(empty.begin() + 24, empty.end(), 0);
+	TempFile emptyIndex(empty);
+	CHECK(!SeekIndex(emptyIndex.path()).lookup(0, entry));
+
+	// Errors
+	CHECK_THROWS(SeekIndex::build(file.data(), firstOffset, 100), std::runtime_error);
+	CHECK_THROWS(SeekIndex seek(TempFile(file).path()), std::runtime_error);
+	auto truncated = index.read();
+	truncated.resize(truncated.size() - 1);
+	CHECK_THROWS(SeekIndex seek(TempFile(truncated).path()), std::runtime_error);
+}
+
+// ====================================
+// Free format frames of the f_size with the padding bit set in every third
+// one. The offsets and sizes are added to the f_ioExpected
+static void appendFreeFormat(Bytes& f_ioStream, FrameTable& f_ioExpected, const Bytes& f_header, unsigned f_size, unsigned f_slot, unsigned f_count)
+{
+	for(unsigned i = 0; i < f_count; ++i)
+	{
+		Bytes header = f_header;
+		bool bPadding = (i % 3 == 2);
+		if(bPadding)
+			header[2] |= 0x02;
+		f_ioExpected.offsets.push_back(f_ioStream.size());
+		f_ioExpected.sizes.push_back(f_size + (bPadding ? f_slot : 0));
+		appendFrames(f_ioStream, header, f_ioExpected.sizes.back(), 1);
+	}
+}
+
+
+static void testFreeFormat()
+{
+	struct Stream
+	{
+		const char*	name;
+		Bytes		header;
+		unsigned	size;
+		unsigned	slot;
+	};
+	static const Stream s_streams[] =
+	{
+		{"MPEG-1 Layer III",	{0xFF, 0xFB, 0x00, 0x00}, 1000, 1},
+		{"MPEG-2 Layer III",	{0xFF, 0xF3, 0x00, 0x00}, 500, 1},
+		{"MPEG-1 Layer II",		{0xFF, 0xFD, 0x00, 0x00}, 800, 1},
+		{"MPEG-1 Layer I",		{0xFF, 0xFF, 0x00, 0x00}, 400, 4}
+	};
+
+	for(auto& stream : s_streams)
+	{
+		// The sync is lost in the junk and found again with the frame size
+		Bytes data;
+		FrameTable expected;
+		appendFreeFormat(data, expected, stream.header, stream.size, stream.slot, 10);
+		auto gapOffset = data.size();
+		data.resize(data.size() + 50, 0x55);
+		appendFreeFormat(data, expected, stream.header, stream.size, stream.slot, 5);
+		auto tailOffset = data.size();
+		data.resize(data.size() + 20, 0);
+
+		auto table = FrameTable::walk(data.data(), data.size());
+		bool bMatch = (table.offsets == expected.offsets) && (table.sizes == expected.sizes) &&
+					  (table.gaps.size() == 1) && (table.gaps[0].offset == gapOffset) && (table.gaps[0].size == 50) &&
+					  (table.tailOffset == tailOffset) && (table.tailSize == 20);
+		if(!bMatch)
+			fprintf(stderr, "%s:\n", stream.name);
+		CHECK(bMatch);
+	}
+
+	// A frame above the highest free format bitrate is not found
+	Bytes data;
+	FrameTable expected;
+	appendFreeFormat(data, expected, s_streams[0].header, 144 * 640000 / 44100 + 2, 1, 10);
+	CHECK(!FrameTable::walk(data.data(), data.size()).getFrameCount());
+	data.clear();
+	appendFreeFormat(data, expected, s_streams[0].header, 144 * 640000 / 44100, 1, 10);
+	CHECK(FrameTable::walk(data.data(), data.size()).getFrameCount() == 10);
+}
+
+// ====================================
+// Requests of the whole f_contents in pieces, one across the end of the file
+// and an empty one
+static void checkReader(IReader& f_reader, int f_fd, const Bytes& f_contents)
+{
+	static const size_t s_piece = 3000;
+	Bytes buffer(f_contents.size() + s_piece);
+	std::vector<ReadRequest> requests;
+	for(size_t offset = 0; offset < f_contents.size(); offset += s_piece)
+		requests.push_back({f_fd, offset, s_piece, buffer.data() + offset, -1});
+	requests.push_back({f_fd, 0, 0, nullptr, -1});
+
+	f_reader.read(requests);
+	for(auto& request : requests)
+		CHECK(request.result == static_cast<ssize_t>(std::min(request.size, f_contents.size() - request.offset)));
+	CHECK(std::equal(f_contents.begin(), f_contents.end(), buffer.begin()));
+}
+
+
+// Replace the io_uring descriptor with /dev/null, so io_uring_enter fails
+static bool breakUring()
+{
+#ifdef __linux__
+	bool bBroken = false;
+	auto dir = opendir("/proc/self/fd");
+	if(!dir)
+		return false;
+	while(auto entry = readdir(dir))
+	{
+		char target[256] = {};
+		auto link = std::string("/proc/self/fd/") + entry->d_name;
+		if((readlink(link.c_str(), target, sizeof(target) - 1) <= 0) || !strstr(target, "io_uring"))
+			continue;
+
+		int fd = open("/dev/null", O_RDONLY);
+		bBroken = (fd >= 0) && (dup2(fd, atoi(entry->d_name)) >= 0);
+		close(fd);
+	}
+	closedir(dir);
+	return bBroken;
+#else
+	return false;
+#endif
+}
+
+
+static void testReader()
+{
+	Bytes contents(100000);
+	for(size_t i = 0; i < contents.size(); ++i)
+		contents[i] = (i * 7) & 0xFF;
+	TempFile file(contents);
+	int fd = open(file.path().c_str(), O_RDONLY);
+	CHECK(fd >= 0);
+
+	auto reader = IReader::create(8);
+	checkReader(*reader, fd, contents);
+
+	// A failed ring falls back to pread, also for the following batches
+	if(!strcmp(reader->name(), "io_uring") && breakUring())
+	{
+		checkReader(*reader, fd, contents);
+		checkReader(*reader, fd, contents);
+	}
+	else
+		printf("reader: io_uring is not available, the fallback is not tested\n");
+
+	close(fd);
+}
+
+
+static void testProcessFiles()
+{
+	const Bytes header = {0xFF, 0xFB, 0x90, 0x00};
+	Bytes id3v1 = {'T', 'A', 'G'};
+	id3v1.resize(128, 0);
+
+	// A file read whole and one with tags beyond the head and tail probes
+	auto small = makeID3v2(100);
+	appendFrames(small, header, 417, 10);
+	auto ape = makeAPE(200, false);
+	small.insert(small.end(), ape.begin(), ape.end());
+	small.insert(small.end(), id3v1.begin(), id3v1.end());
+
+	auto large = makeID3v2(40000);
+	appendFrames(large, header, 417, 200);
+	auto lyrics = makeLyrics3(30000);
+	large.insert(large.end(), lyrics.begin(), lyrics.end());
+	large.insert(large.end(), id3v1.begin(), id3v1.end());
+
+	// Frames which differ from each other
+	std::vector<Bytes> contents = {small, large};
+	for(auto& file : contents)
+	{
+		auto layout = Layout::probe(file.data(), file.size());
+		for(size_t offset = layout.mpegOffset; offset < layout.trailerOffset(); offset += 417)
+			file[offset + 36] = offset / 417;
+	}
+	TempFile smallFile(contents[0]);
+	TempFile largeFile(contents[1]);
+
+	unsigned nProcessed = 0;
+	processFiles({smallFile.path(), largeFile.path()}, LoadedFile::Parts::ID3v2 | LoadedFile::Parts::Trailer | LoadedFile::Parts::MPEG,
+				 [&](size_t f_index, LoadedFile& f_file)
+	{
+		auto& file = contents[f_index];
+		auto layout = Layout::probe(file.data(), file.size());
+		CHECK(f_file.error.empty() && (f_file.layout.mpegOffset == layout.mpegOffset) && (f_file.layout.mpegSize == layout.mpegSize));
+		auto isPart = [&file](ByteView f_part, size_t f_offset, size_t f_size)
+		{
+			return (f_part.size == f_size) && !memcmp(f_part.data, &file[f_offset], f_size);
+		};
+		CHECK(isPart(f_file.id3v2, layout.id3v2Offset, layout.id3v2Size));
+		CHECK(isPart(f_file.mpeg, layout.mpegOffset, layout.mpegSize));
+		CHECK(isPart(f_file.trailer, layout.trailerOffset(), layout.trailerSize()));
+		f_file.release();
+		++nProcessed;
+	});
+	CHECK(nProcessed == 2);
+
+	// A missing file is reported with an error
+	processFiles({smallFile.path() + ".missing"}, LoadedFile::Parts::MPEG, [&](size_t, LoadedFile& f_file)
+	{
+		CHECK(!f_file.error.empty() && !f_file.mpeg.data);
+		++nProcessed;
+	});
+	CHECK(nProcessed == 3);
+}
+
+// ====================================
+// Verify the whole file in the f_contents
+static unsigned verifyBytes(const Bytes& f_contents, std::vector<std::string>& f_outIssues)
+{
+	LoadedFile file;
+	file.layout = Layout::probe(f_contents.data(), f_contents.size());
+	file.id3v2 = {f_contents.data() + file.layout.id3v2Offset, file.layout.id3v2Size};
+	file.mpeg = {f_contents.data() + file.layout.mpegOffset, file.layout.mpegSize};
+
+	unsigned nFrames = 0;
+	f_outIssues.clear();
+	CHECK(verifyFile(file, false, nFrames, f_outIssues));
+	return nFrames;
+}
+
+
+static bool hasIssue(const std::vector<std::string>& f_issues, const std::string& f_text)
+{
+	return std::any_of(f_issues.begin(), f_issues.end(), [&f_text](const std::string& f_issue) { return hasText(f_issue, f_text); });
+}
+
+
+static void testVerifyFile()
+{
+	// MPEG-1 Layer III with a CRC, 128 kbps, 44.1 kHz
+	const Bytes header = {0xFF, 0xFA, 0x90, 0x00};
+	static const size_t s_frameSize = 417;
+	static const unsigned s_nFrames = 10;
+
+	// Info frame with the counts and the protected frames which differ from
+	// each other
+	auto file = makeID3v2(10);
+	auto xingOffset = file.size();
+	auto xingFrame = makeXingFrame(header.data(), false);
+	auto xingSize = xingFrame.size();
+	file.insert(file.end(), xingFrame.begin(), xingFrame.end());
+	auto audioOffset = file.size();
+	appendFrames(file, header, s_frameSize, s_nFrames);
+	FrameHeader parsed;
+	CHECK(FrameHeader::parse(header.data(), parsed) && parsed.protection && (parsed.size == s_frameSize));
+	for(unsigned i = 0; i < s_nFrames; ++i)
+	{
+		auto frame = &file[audioOffset + i * s_frameSize];
+		frame[100] = i + 1;
+		auto crc = calcFrameCRC(frame, parsed);
+		frame[4] = crc >> 8;
+		frame[5] = crc & 0xFF;
+	}
+	auto setXing = [&](Bytes& f_ioFile, unsigned f_frames, unsigned f_bytes)
+	{
+		XingHeader xing;
+		CHECK(XingHeader::parse(&f_ioFile[xingOffset], xingSize, xing));
+		xing.frames = f_frames;
+		xing.bytes = f_bytes;
+		xing.write(&f_ioFile[xingOffset]);
+	};
+	setXing(file, s_nFrames, xingSize + s_nFrames * s_frameSize);
+	Bytes id3v1 = {'T', 'A', 'G'};
+	id3v1.resize(128, 0);
+	file.insert(file.end(), id3v1.begin(), id3v1.end());
+
+	std::vector<std::string> issues;
+	CHECK((verifyBytes(file, issues) == 1 + s_nFrames) && issues.empty());
+	// Encoders disagree whether the counts include the Info frame
+	auto counted = file;
+	setXing(counted, 1 + s_nFrames, file.size());
+	CHECK(verifyBytes(counted, issues) && issues.empty());
+
+	// A flipped CRC byte
+	auto crc = file;
+	auto frame4 = audioOffset + 3 * s_frameSize;
+	crc[frame4 + 5] ^= 0x01;
+	CHECK(verifyBytes(crc, issues) == 1 + s_nFrames);
+	CHECK((issues.size() == 1) && hasText(issues[0], "@ " + std::to_string(frame4) + " ") && hasText(issues[0], "frame #4 CRC mismatch"));
+	// The CRC covers the side information
+	crc = file;
+	crc[frame4 + 10] ^= 0x80;
+	CHECK(verifyBytes(crc, issues) && (issues.size() == 1) && hasText(issues[0], "frame #4 CRC mismatch"));
+
+	// Junk injected between the frames
+	auto junk = file;
+	auto frame6 = audioOffset + 5 * s_frameSize;
+	junk.insert(junk.begin() + frame6, 50, 0);
+	CHECK(verifyBytes(junk, issues) == 1 + s_nFrames);
+	CHECK(hasIssue(issues, "@ " + std::to_string(frame6) + " (0x") && hasIssue(issues, "lost sync, 50 bytes skipped"));
+	CHECK(hasIssue(issues, "Xing header declares " + std::to_string(xingSize + s_nFrames * s_frameSize) + " bytes"));
+	CHECK(!hasIssue(issues, "CRC"));
+
+	// Junk after the last frame
+	junk = file;
+	junk.insert(junk.end() - 128, 300, 0);
+	CHECK(verifyBytes(junk, issues) == 1 + s_nFrames);
+	CHECK((issues.size() == 1) && hasText(issues[0], "300 bytes of junk after the last frame"));
+
+	// A truncated last frame
+	auto truncated = file;
+	truncated.erase(truncated.end() - 128 - 100, truncated.end() - 128);
+	CHECK(verifyBytes(truncated, issues) == s_nFrames);
+	auto lastOffset = audioOffset + (s_nFrames - 1) * s_frameSize;
+	CHECK(hasIssue(issues, "@ " + std::to_string(lastOffset) + " (0x") &&
+		  hasIssue(issues, "truncated final frame, " + std::to_string(s_frameSize - 100) + " bytes"));
+	CHECK(hasIssue(issues, "bytes, " + std::to_string(xingSize + (s_nFrames - 1) * s_frameSize) + " found"));
+	CHECK(!hasIssue(issues, "junk"));
+
+	// Wrong Xing counts
+	auto counts = file;
+	setXing(counts, s_nFrames + 5, 1000);
+	CHECK(verifyBytes(counts, issues) == 1 + s_nFrames);
+	CHECK(issues.size() == 2);
+	CHECK(hasIssue(issues, "@ " + std::to_string(xingOffset + 36) + " (0x"));
+	CHECK(hasIssue(issues, "Xing header declares " + std::to_string(s_nFrames + 5) + " frames, " + std::to_string(s_nFrames) + " found"));
+	CHECK(hasIssue(issues, "Xing header declares 1000 bytes, " + std::to_string(xingSize + s_nFrames * s_frameSize) + " found"));
+
+	// No frames at all
+	Bytes empty = makeID3v2(10);
+	empty.resize(empty.size() + 1000, 0);
+	CHECK(!verifyBytes(empty, issues) && hasIssue(issues, "no MPEG frames"));
+}
+
+// ====================================
+static std::string getStats(const Bytes& f_mpeg)
+{
+	LoadedFile file;
+	file.path = "a.mp3";
+	file.layout = Layout::probe(f_mpeg.data(), f_mpeg.size());
+	file.mpeg = {f_mpeg.data() + file.layout.mpegOffset, file.layout.mpegSize};
+	return getFrameStats(file);
+}
+
+
+static void testFrameStats()
+{
+	// CBR of 128 kbps at 44.1 kHz, i.e. 38.28 frames per second
+	Bytes cbr;
+	appendFrames(cbr, {0xFF, 0xFB, 0x90, 0x00}, 417, 100);
+	auto stats = getStats(cbr);
+	CHECK(hasText(stats, "{\"path\":\"a.mp3\",\"frames\":100,\"xing\":false,"));
+	CHECK(hasText(stats, ",\"bytes\":41700,\"bitrate\":{\"min\":128,\"max\":128,"));
+	CHECK(hasText(stats, ",\"histogram\":{\"128\":100}"));
+	CHECK(hasText(stats, ",\"frameSize\":{\"min\":417,\"max\":417,\"p50\":417,\"p90\":417,\"p99\":417}"));
+	// Frames 0-38, 39-76 and 77-99 start within the windows
+	CHECK(hasText(stats, ",\"window\":1,\"bytesPerWindow\":[16263,15846,9591]"));
+	CHECK(hasText(stats, ",\"paddedFrames\":0,\"paddingBytes\":0,\"junkBytes\":0}"));
+
+	// VBR of 64, 128 (one padded) and 192 kbps frames after an Info frame
+	// and junk after the last frame
+	auto vbr = makeXingFrame(cbr.data(), true);
+	appendFrames(vbr, {0xFF, 0xFB, 0x50, 0x00}, 208, 5);
+	appendFrames(vbr, {0xFF, 0xFB, 0x90, 0x00}, 417, 3);
+	appendFrames(vbr, {0xFF, 0xFB, 0xB0, 0x00}, 626, 1);
+	appendFrames(vbr, {0xFF, 0xFB, 0x92, 0x00}, 418, 1);
+	vbr.resize(vbr.size() + 20, 0);
+	stats = getStats(vbr);
+	CHECK(hasText(stats, "\"frames\":10,\"xing\":true,"));
+	CHECK(hasText(stats, ",\"bytes\":3335,\"bitrate\":{\"min\":64,\"max\":192,"));
+	CHECK(hasText(stats, ",\"histogram\":{\"64\":5,\"128\":4,\"192\":1}"));
+	// Nearest rank of the sizes 208 x5, 417 x3, 418, 626
+	CHECK(hasText(stats, ",\"frameSize\":{\"min\":208,\"max\":626,\"p50\":208,\"p90\":418,\"p99\":626}"));
+	CHECK(hasText(stats, ",\"bytesPerWindow\":[3335]"));
+	CHECK(hasText(stats, ",\"paddedFrames\":1,\"paddingBytes\":1,\"junkBytes\":20}"));
+
+	// An unreadable file
+	LoadedFile file;
+	file.path = "b.mp3";
+	file.error = "failed";
+	CHECK(getFrameStats(file) == "{\"path\":\"b.mp3\",\"error\":\"failed\"}");
+}
+
+// ====================================
+struct Test
+{
+	const char*	name;
+	void		(*run)();
+};
+
+static const Test s_tests[] =
+{
+	{"id3v2",		testID3v2},
+	{"patch",		testPatchFile},
+	{"atomic",		testWriteFileAtomic},
+	{"overrun",		testID3v2Overrun},
+	{"trailer",		testProbeTrailer},
+	{"sideinfo",	testSideInfo},
+	{"bridge",		testReservoirBridge},
+	{"plan",		testPlanOutput},
+	{"lametag",		testLameTag},
+	{"xing",		testXing},
+	{"hash64",		testHash64},
+	{"seekindex",	testSeekIndex},
+	{"freeformat",	testFreeFormat},
+	{"reader",		testReader},
+	{"batch",		testProcessFiles},
+	{"verify",		testVerifyFile},
+	{"stats",		testFrameStats}
+};
+
+
+int main(int argc, const char* args[])
+{
+	unsigned nRun = 0;
+	for(auto& test : s_tests)
+	{
+		bool bSelected = (argc < 2);
+		for(int i = 1; i < argc; ++i)
+			bSelected = bSelected || !strcmp(args[i], test.name);
+		if(!bSelected)
+			continue;
+
+		auto nFailures = s_failures;
+		try
+		{
+			test.run();
+		}
+		catch(const std::exception& e)
+		{
+			fprintf(stderr, "unexpected exception: %s\n", e.what());
+			++s_failures;
+		}
+		printf("%s: %s\n", test.name, (s_failures == nFailures) ? "OK" : "FAILED");
+		++nRun;
+	}
+
+	if(!nRun)
+	{
+		fprintf(stderr, "no tests to run\n");
+		return 2;
+	}
+	return s_failures ? 1 : 0;
+}